@@ -0,0 +1,87 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <string>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdio.h>
+
+// == batch processing ======================================================
+// split input at line (or </DOC> line) boundaries into batches, transform batches on worker threads,
+// write results in input order so output is identical to processing the input serially
+
+// growable output buffer, written with one fwrite per flush
+class OutBuf { protected: char* b; size_t n, size; public:
+  OutBuf() { b=(char*)malloc(size=1<<20); n=0; }
+  virtual ~OutBuf() { free(b); b=NULL; }
+  inline void grow(size_t l) { while (n+l>size) { size*=2; b=(char*)realloc(b,size); } }
+  inline void put(char c) { if (n>=size) grow(1); b[n++]=c; }
+  inline void write(const char* s, size_t l) { if (n+l>size) grow(l); memcpy(b+n,s,l); n+=l; }
+  inline void line(const std::string& s) { write(s.c_str(),s.length()); put('\n'); }
+  inline void flush(FILE* out) { if (n>0) fwrite(b,1,n,out); n=0; }
+  inline void flushlarge(FILE* out) { if (n>=(1<<20)) flush(out); }
+  inline const char* data() const { return b; }
+  inline size_t length() const { return n; }
+  inline void clear() { n=0; }
+};
+
+// lines from an in-memory batch (same lines as std::getline)
+class LineReader { protected: const char* d; const char* dend; public:
+  LineReader(const std::string& s) { d=s.c_str(); dend=d+s.length(); }
+  inline bool getline(std::string& line) { if (d>=dend) return false;
+    const char* e=(const char*)memchr(d,'\n',dend-d); if (e==NULL) e=dend;
+    line.assign(d,e-d); d=(e<dend?e+1:e); return true; }
+  // same line as a span in place (no copy), s[l] is the '\n' or end of input
+  inline bool getline(const char*& s, size_t& l) { if (d>=dend) return false;
+    const char* e=(const char*)memchr(d,'\n',dend-d); if (e==NULL) e=dend;
+    s=d; l=e-d; d=(e<dend?e+1:e); return true; }
+};
+
+struct Batch { std::string in, err; OutBuf out; };
+
+// next batch of whole lines (bDocs: ending with a </DOC> line) into b, leftover kept in carry, false at end of input
+static bool readBatch(FILE* in, std::string& carry, std::string& b, bool bDocs, size_t bsize=1<<22) {
+  b.swap(carry); carry.clear();
+  for (;;) {
+    size_t s=b.size(); b.resize(s+bsize); size_t r=fread(&b[s],1,bsize,in); b.resize(s+r);
+    if (r==0) return false; // remainder is last batch
+    size_t cut=std::string::npos; // only the new bytes (and a separator overlap) are searched, earlier ones had no cut
+    if (!bDocs) { const char* e=(const char*)memrchr(&b[s],'\n',r); if (e!=NULL) cut=e-b.data()+1; }
+    else { for (size_t p=b.find("\n</DOC>\n",std::max(s,(size_t)7)-7);p!=std::string::npos;p=b.find("\n</DOC>\n",p+1)) { cut=p+8; }
+      if (cut==std::string::npos && b.compare(0,7,"</DOC>\n")==0) cut=7; }
+    if (cut!=std::string::npos && cut>0) { carry.assign(b,cut,std::string::npos); b.resize(cut); return true; }
+  }
+}
+
+// transform(Batch&) fills out (and err) from in; first is input already consumed (e.g. a peeked line)
+template <class F> void runBatches(FILE* in, FILE* out, bool bDocs, int threads, const std::string& first, F transform) {
+  std::string carry=first;
+  if (threads<=1) { Batch b; for (bool more=true;more;) { more=readBatch(in,carry,b.in,bDocs); transform(b); b.out.flush(out); fputs(b.err.c_str(),stderr); b.err.clear(); } return; }
+  const int N=2*threads; std::vector<Batch> slots(N); std::vector<int> state(N,0); //0=free,1=read,2=transformed
+  std::mutex m; std::condition_variable cv; uint64_t nread=0, ntake=0; bool eof=false;
+  std::vector<std::thread> workers;
+  for (int t=0;t<threads;t++) { workers.push_back(std::thread([&]() {
+    for (;;) { uint64_t i;
+      { std::unique_lock<std::mutex> l(m); cv.wait(l,[&]{ return ntake<nread || eof; }); if (ntake>=nread) return; i=ntake++; }
+      transform(slots[i%N]);
+      { std::lock_guard<std::mutex> l(m); state[i%N]=2; } cv.notify_all();
+    } })); }
+  std::thread writer([&]() {
+    for (uint64_t i=0;;i++) { Batch& b=slots[i%N];
+      { std::unique_lock<std::mutex> l(m); cv.wait(l,[&]{ return state[i%N]==2 || (eof && i>=nread); }); if (state[i%N]!=2) return; }
+      b.out.flush(out); fputs(b.err.c_str(),stderr); b.err.clear();
+      { std::lock_guard<std::mutex> l(m); state[i%N]=0; } cv.notify_all();
+    } });
+  for (bool more=true;more;) { uint64_t i=nread; Batch& b=slots[i%N];
+    { std::unique_lock<std::mutex> l(m); cv.wait(l,[&]{ return state[i%N]==0; }); }
+    more=readBatch(in,carry,b.in,bDocs);
+    { std::lock_guard<std::mutex> l(m); state[i%N]=1; nread++; } cv.notify_all();
+  }
+  { std::lock_guard<std::mutex> l(m); eof=true; } cv.notify_all();
+  for (int t=0;t<threads;t++) { workers[t].join(); } writer.join();
+}
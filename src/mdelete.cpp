@@ -0,0 +1,32 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <set>
+
+#include "mmeta.hpp"
+#include "msegment.hpp"
+
+/* mark documents (by DOCNO) deleted in a mindex or all segments of a manifest, msearch skips them and mmerge drops them */
+
+// returns number of newly deleted documents in the segment
+static int markDeleted(cchar* fn, const std::set<std::string>& docnos) {
+  MSegment sg(fn,true); int n=0; char c[1<<10];
+  for (int i=0;i<sg.docs->size();i++) { sg.docs->getK(i,c,1<<10); if (!sg.deleted.test(i) && docnos.find(c)!=docnos.end()) { sg.deleted.set(i); n++; } }
+  if (n>0) sg.deleted.write(fn);
+  std::cerr<<"Deleted "<<n<<" documents in "<<fn<<" ("<<sg.deleted.deleted()<<" of "<<sg.docs->size()<<" now deleted)"<<std::endl;
+  return n;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc!=3) { std::cerr<<"Usage: ./mdelete.exe data.mindex|index.mseg docno_values.txt"<<std::endl<<" to update a document delete it first, then add a segment with its new version"<<std::endl; return -1; }
+  std::set<std::string> docnos;
+  { std::ifstream in(argv[2]); if (!in) {std::cerr<<"ERROR: invalid "<<argv[2]<<std::endl; exit(-1);}
+    for (std::string line; getline(in,line);) { if (line.compare("")!=0) docnos.insert(line); } }
+  int n=0;
+  if (!MManifest::isManifest(argv[1])) n=markDeleted(argv[1],docnos);
+  else { MManifest m(argv[1]); m.lock(); m.read(); for (int i=0;i<m.segs.size();i++) { n+=markDeleted(m.segs[i].c_str(),docnos); } m.unlock(); }
+  std::cerr<<"Deleted "<<n<<" documents"<<std::endl;
+  return 0;
+}
@@ -97,10 +97,10 @@ struct IntV { uint64_t v; IntV(uint64_t v=0) {this->v=v;} inline void setid(int
 
 // == DictionaryTwoLayer ======================================================
 
-struct IntDeltaV { uint64_t v; IntDeltaV(uint64_t v=0) {this->v=v;} inline void setid(int id) {}
+struct IntDeltaV { uint64_t v; int id; IntDeltaV(uint64_t v=0) {this->v=v; id=-1;} inline void setid(int i) {id=i;} // id valid from getV(c)
   operator uint64_t() { return v; }
   inline void write(byte*& d, IntDeltaV& lastv) { writeVByte(d,v-lastv.v); }
-  inline void read(byte*& d) { v+=readVByte(d); }
+  inline void read(byte*& d) { v+=readVByte(d); id++; }
   static const uint64_t UNKNOWN = (uint64_t)-1L;
 };
 #define V IntDeltaV
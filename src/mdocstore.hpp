@@ -0,0 +1,106 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <unistd.h> // for pread, close
+#include <sys/stat.h>
+#include <sys/fcntl.h> // for O_RDONLY
+#include <sys/mman.h> // for mmap
+
+// uses DocnamesTwoLayer, so include after mdictionary.hpp
+
+// == DocStore ======================================================
+// random access to TREC documents: DOCNO -> (file, offset, length) found by one scan of the collection,
+// DOCNOs kept in a DocnamesTwoLayer pointing into a location array (repeated DOCNOs are consecutive)
+
+static inline std::string mathDOCNO(bool bMath, std::string s) { if (bMath) { int c=s.find_last_of('_'); if (c>=0) s=s.substr(c+1); } return s; }
+
+struct DocLoc { uint64_t off; uint32_t len; uint16_t file; uint16_t more; // more: next location has the same DOCNO
+  inline bool operator<(const DocLoc& o) const { return file<o.file || (file==o.file && off<o.off); } // collection order
+  inline bool operator==(const DocLoc& o) const { return file==o.file && off==o.off; }
+};
+static const cchar* DocStoreName="mextract.docidx.1";
+
+class DocStore { protected: bool bMath; std::vector<std::string> files; std::vector<int> fds; DocnamesTwoLayer* docs; std::vector<DocLoc> locs;
+public:
+  DocStore() { bMath=false; docs=NULL; }
+  virtual ~DocStore() { for (int i=0;i<fds.size();i++) { close(fds[i]); } fds.clear(); if (docs!=NULL) delete docs; docs=NULL; }
+
+  // scan TREC files, a DOC spans from after the previous </DOC> line through its </DOC> line (same as streaming extraction)
+  static void build(cchar* outfn, const std::vector<std::string>& fns, bool bMath) {
+    if (fns.size()>=(1<<16)) {std::cerr<<"ERROR: too many input files "<<fns.size()<<std::endl; exit(-1);}
+    struct E { std::string k; DocLoc l; }; std::vector<E> v;
+    for (int f=0;f<fns.size();f++) { cchar* fn=fns[f].c_str();
+      int fd=open(fn,O_RDONLY); if (fd<0) {std::cerr<<"ERROR: Could not open input file "<<fn<<std::endl; exit(-1);}
+      struct stat sb; fstat(fd,&sb); uint64_t size=sb.st_size; if (size==0) { close(fd); continue; }
+      cchar* d=(cchar*)mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0); if (d==MAP_FAILED) {std::cerr<<"ERROR: failed memory map of "<<fn<<std::endl; exit(-1);}
+      madvise((void*)d,size,MADV_SEQUENTIAL);
+      uint64_t start=0; bool decided=false, valid=false; std::string key;
+      for (uint64_t p=0;p<size;) { cchar* e=(cchar*)memchr(d+p,'\n',size-p); uint64_t l=(e==NULL?size:e-d)-p, next=p+l+1;
+        if (l==6 && memcmp(d+p,"</DOC>",6)==0) {
+          if (valid) { if (std::min(next,size)-start>=(1ull<<32)) {std::cerr<<"ERROR: document too large "<<key<<std::endl; exit(-1);}
+            v.push_back(E{key,DocLoc{start,(uint32_t)(std::min(next,size)-start),(uint16_t)f,0}}); }
+          start=next; decided=valid=false;
+        } else if (!decided && l>7 && memcmp(d+p,"<DOCNO>",7)==0) { decided=true; // first DOCNO line decides
+          std::string line(d+p,l); int c=line.find("</DOCNO>",7);
+          if (c>=0) { key=mathDOCNO(bMath,line.substr(7,c-7)); valid=(key.size()>0); }
+        }
+        p=next;
+      }
+      munmap((void*)d,size); close(fd);
+    }
+    std::stable_sort(v.begin(),v.end(),[](const E& a, const E& b){ return strcmp(a.k.c_str(),b.k.c_str())<0; });
+    DocnamesTwoLayer names; std::vector<DocLoc> locs; std::string last;
+    for (int i=0;i<v.size();i++) {
+      if (i==0 || v[i].k.compare(last)!=0) { names.add(v[i].k.c_str(),last.c_str(),locs.size()); last=v[i].k; } else locs.back().more=1;
+      locs.push_back(v[i].l); }
+    names.addEnd();
+    std::ofstream out(outfn); if (!out) {std::cerr<<"ERROR: Could not write "<<outfn<<std::endl; exit(-1);}
+    out<<DocStoreName<<std::endl<<(bMath?1:0)<<std::endl<<fns.size()<<std::endl;
+    for (int f=0;f<fns.size();f++) { out<<fns[f]<<std::endl; }
+    names.write(out); out<<locs.size()<<std::endl; out.write((cchar*)locs.data(),locs.size()*sizeof(DocLoc)); out<<std::endl;
+    out.close();
+    std::cerr<<"Indexed "<<locs.size()<<" documents ("<<names.size()<<" DOCNOs) from "<<fns.size()<<" files"<<std::endl;
+  }
+
+  void load(cchar* fn) { std::string line;
+    std::ifstream in(fn); if (!in) {std::cerr<<"ERROR: loading document index "<<fn<<std::endl; exit(-1);}
+    getline(in,line); if (line.compare(DocStoreName)!=0) {std::cerr<<"ERROR: Unknown file format "<<fn<<" "<<line<<std::endl; exit(-1);}
+    int m, n; in>>m>>n; getline(in,line); if (line.compare("")!=0) {std::cerr<<"ERROR: document index "<<fn<<" info "<<line<<std::endl; exit(-1);}
+    bMath=(m!=0);
+    for (int f=0;f<n;f++) { getline(in,line); files.push_back(line);
+      int fd=open(line.c_str(),O_RDONLY); if (fd<0) {std::cerr<<"ERROR: Could not open input file "<<line<<std::endl; exit(-1);} fds.push_back(fd); }
+    docs=new DocnamesTwoLayer(in,fn);
+    uint64_t nl; in>>nl; getline(in,line); if (line.compare("")!=0) {std::cerr<<"ERROR: document index "<<fn<<" locations "<<line<<std::endl; exit(-1);}
+    locs.resize(nl); in.read((char*)locs.data(),nl*sizeof(DocLoc));
+    getline(in,line); if (!in || line.compare("")!=0) {std::cerr<<"ERROR: document index "<<fn<<" locations data "<<line<<std::endl; exit(-1);}
+  }
+
+  inline uint size() { return locs.size(); }
+
+  // locations of all DOCs with this DOCNO (mapped as when built), appended to r
+  inline void find(const std::string& docno, /*out*/std::vector<DocLoc>& r) {
+    uint64_t i=docs->getV(mathDOCNO(bMath,docno).c_str()); if (i==IntV::UNKNOWN) return;
+    for (;i<locs.size();i++) { r.push_back(locs[i]); if (!locs[i].more) break; }
+  }
+
+  inline void read(const DocLoc& l, /*out*/std::string& s) { s.resize(l.len);
+    if (pread(fds[l.file],&s[0],l.len,l.off)!=(ssize_t)l.len) {std::cerr<<"ERROR: reading "<<files[l.file]<<" at "<<l.off<<std::endl; exit(-1);}
+    if (s.back()!='\n') s+='\n'; }
+
+  // read DOCs (in parallel with threads>1) and write them in the given order
+  void output(const std::vector<DocLoc>& v, FILE* out, int threads) {
+    if (threads<=1) { std::string s; for (int i=0;i<v.size();i++) { read(v[i],s); fwrite(s.data(),1,s.size(),out); } return; }
+    std::vector<std::string> d(v.size()); std::vector<std::thread> workers;
+    for (int t=0;t<threads;t++) { workers.push_back(std::thread([&,t]() { for (int i=t;i<v.size();i+=threads) read(v[i],d[i]); })); }
+    for (int t=0;t<threads;t++) { workers[t].join(); }
+    for (int i=0;i<v.size();i++) { fwrite(d[i].data(),1,d[i].size(),out); }
+  }
+};
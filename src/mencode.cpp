@@ -7,40 +7,72 @@
 #include <fstream>
 #include <string>
 #include <cstring>
-#include <sys/stat.h>
+#include <vector>
+#include <thread>
+#include <cmath> // for nextafterf
+#include <unistd.h> // for close
+#include <sys/fcntl.h> // for O_RDONLY
+#include <sys/mman.h> // for mmap
 
-#include "mdictionary.hpp"
+#include "mmeta.hpp"
 
 /* read in mindex file, output dict file pointing into it */
 
 class MEncode { protected:
-  DocnamesTwoLayer docs; uint64_t totaltokens;
-  DictionaryTwoLayer dict;
-  void inputPostings(std::ifstream& in, const char* fn) {
-    int count=0; std::string line, lasttoken="";
+  MMeta meta; std::vector<int> docsizes;
+  cchar* mm; uint64_t msize; //memory map of mindex
+  std::vector<uint64_t> pls; std::vector<uint> blens; //postings data per list (for stats)
+
+  void inputPostings(uint64_t loc, const char* fn) {
+    int count=0; cchar* mend=mm+msize;
     for (;;) {
       // name+size
-      uint64_t loc=in.tellg();
-      std::string token; in>>token; if (token.compare("")==0) break;
-      int blen; in>>blen;
-      getline(in,line); if (line.compare("")!=0) {std::cerr<<"ERROR: index "<<fn<<" postings info "<<token<<std::endl; exit(-1);}
+      for (;loc<msize && isspace(mm[loc]);loc++) {}
+      if (loc>=msize) break;
+      cchar* t=mm+loc; cchar* x=t; for (;x<mend && *x!='\t';x++) {}
+      std::string token(t,x-t); uint64_t blen=0; x++;
+      for (;x<mend && *x>='0' && *x<='9';x++) { blen=blen*10+(*x-'0'); }
+      if (x>=mend || *x!='\n') {std::cerr<<"ERROR: index "<<fn<<" postings info "<<token<<std::endl; exit(-1);}
+      x++;
       // postings
-      cchar* c=token.c_str(); cchar* lastc=lasttoken.c_str();
-      //if ((lastc[0]!=0) && (strcmp(c,lastc)<0)) {cerr<<"ERROR: non-ordered\t"<<c<<"\t"<<lastc<<"\t"<<strcmp(c,lastc)<<endl;exit(-1);}
-      dict.add(c,lastc,loc); // point to (token \t bytelength \n data)
-      lasttoken=token;
-      in.ignore(blen);
-      getline(in,line); if (line.compare("")!=0) {std::cerr<<"ERROR: index "<<fn<<" postings "<<token<<std::endl; exit(-1);}
+      meta.addToken(token.c_str(),loc); // point to (token \t bytelength \n data)
+      if (bStats) { pls.push_back(x-mm); blens.push_back(blen); }
+      if (x+blen>=mend || x[blen]!='\n') {std::cerr<<"ERROR: index "<<fn<<" postings "<<token<<std::endl; exit(-1);}
+      loc=x+blen+1-mm;
       count++;
     }
     std::cerr<<"Input "<<count<<" postings lists."<<std::endl;
-    dict.addEnd();
-    std::cerr<<"dictionary "<<dict.memoryusage()<<" bytes "<<(double)dict.memoryusage()/count<<" b/entry"<<std::endl;
+  }
+
+  // decode lists [s,e) for max tf and max BM25 tf component
+  void computeStats(int s, int e, float avgDocSize) {
+    for (int i=s;i<e;i++) {
+      byte* d=(byte*)mm+pls[i]; byte* dend=d+blens[i]; TermStat& st=meta.stats[i]; st.maxtf=0; st.maxbm25tf=0.0f;
+      forPostings(d,dend,[&](uint id, uint freq) { // VByte or bitmap
+        if (id>=docsizes.size()) {std::cerr<<"ERROR: docid "<<id<<" out of range in list "<<i<<std::endl; exit(-1);}
+        st.maxtf=std::max(st.maxtf,freq); st.maxbm25tf=std::max(st.maxbm25tf,bm25tf(freq,docsizes[id],avgDocSize)); });
+      st.maxbm25tf=nextafterf(st.maxbm25tf,3.0f); // round up so float summation order cannot undercut a real score
+    }
+  }
+
+  void inputStats() {
+    int n=pls.size(); meta.stats.resize(n);
+    float avgDocSize=(double)meta.totaltokens/docsizes.size();
+    // split lists into byte-balanced ranges at list boundaries
+    uint64_t total=0; for (int i=0;i<n;i++) { total+=blens[i]; }
+    std::vector<std::thread> t; uint64_t acc=0;
+    for (int p=0,s=0,i=0;p<threads;p++) {
+      uint64_t target=total*(p+1)/threads; for (;i<n && (acc<target||p==threads-1);i++) { acc+=blens[i]; }
+      t.push_back(std::thread(&MEncode::computeStats,this,s,i,avgDocSize)); s=i;
+    }
+    for (int p=0;p<t.size();p++) { t[p].join(); }
+    std::cerr<<"Computed stats for "<<n<<" postings lists using "<<threads<<" threads."<<std::endl;
   }
 public:
-  MEncode() { totaltokens=0L; }
+  bool bStats; int threads;
+  MEncode() { bStats=false; threads=1; mm=NULL; msize=0; }
   void input(const char* fn) {
-    std::ifstream in(fn); std::string line, lastdoc="";
+    std::ifstream in(fn); std::string line;
     if (!in.is_open()) {std::cerr<<"ERROR: Could not open input file "<<fn<<std::endl; exit(-1);}
     // decide what type of file
     getline(in,line); if (!in) {std::cerr<<"ERROR: Empty input file "<<fn<<std::endl; exit(-1);}
@@ -51,26 +83,36 @@ public:
     // size+docnames
     for (int i=0;i<doccount;i++) {
       int docsize; in>>docsize; in>>std::ws; getline(in,line);
-      docs.add(line.c_str(),lastdoc.c_str(),docsize); totaltokens+=docsize; lastdoc=line;
+      meta.addDoc(line.c_str(),docsize); if (bStats) docsizes.push_back(docsize);
     }
-    docs.addEnd();
     getline(in,line); if (line.compare("")!=0) {std::cerr<<"ERROR: index "<<fn<<" document names "<<line<<std::endl;}
     std::cerr<<"Input "<<doccount<<" document names."<<std::endl;
     // postings
-    inputPostings(in,fn);
+    uint64_t loc=in.tellg(); in.close();
+    int fd=open(fn,O_RDONLY); struct stat sb; fstat(fd,&sb); msize=sb.st_size;
+    mm=(cchar*)mmap(NULL,msize,PROT_READ,MAP_SHARED,fd,0);
+    if (mm==MAP_FAILED) {std::cerr<<"ERROR: failed memory map of index file "<<fn<<std::endl; exit(-1);}
+    madvise((void*)mm,msize,MADV_SEQUENTIAL);
+    inputPostings(loc,fn);
+    if (bStats) inputStats();
+    munmap((void*)mm,msize); mm=NULL; close(fd);
     // write
-    std::string metafn=(std::string)fn+".meta"; std::ofstream out(metafn);
-    struct stat sb; int er=stat(fn,&sb); uint64_t fsize=(uint64_t)sb.st_size; out<<fsize<<std::endl; // index file size to ensure correct pairing
-    docs.write(out); out<<totaltokens<<std::endl; dict.write(out); out.close();
+    meta.write(fn);
   }
 };
 
-static void usage() {std::cerr<<"Usage: ./mencode.exe data.mindex"<<std::endl; exit(-1);}
+static void usage() {std::cerr<<"Usage: ./mencode.exe [-s] [-t#] data.mindex"<<std::endl<<"  where -s per-term stats for query pruning, -t threads computing stats"<<std::endl; exit(-1);}
 
 int main(int argc, char *argv[]) {
-  if (argc!=2) usage();
-  std::cerr<<"Input "<<argv[1]<<std::endl;
-  MEncode ms; ms.input(argv[1]); // from mindex
+  MEncode ms; int s=1;
+  for (;;) {
+    if (s<argc && strcmp(argv[s],"-s")==0) { ms.bStats=true; s++; }
+    else if (s<argc && strstr(argv[s],"-t")==argv[s]) { ms.threads=std::stoi(argv[s]+2); if (ms.threads<1) usage(); s++; }
+    else if (argc-s!=1) usage();
+    else break;
+  }
+  std::cerr<<"Input "<<argv[s]<<std::endl;
+  ms.input(argv[s]); // from mindex
   std::cerr<<"Done input."<<std::endl;
   return 0;
 }
@@ -12,6 +12,7 @@
 #include <chrono>
 
 #include "mtokenizer.hpp"
+#include "mmeta.hpp"
 
 /* read in TREC files (optionally via mstrip), invert the text, output mindex file */
 
@@ -80,9 +81,9 @@ class Dictionary : protected std::map<cchar*, PostingsList, charcmp> { protected
       (*this)[tokencopy].add(docid,count);
     } else { it->second.add(docid,count); }
   }
-  void output(std::ostream& out) { // uncompressed
+  void output(std::ostream& out, CountBuf& cb, MMeta* meta) { // uncompressed
     std::cerr<<"Outputting "<<size()<<" postings lists."<<std::endl;
-    for (iterator it=begin();it!=end();++it) { out<<it->first<<"\t"; it->second.output(out); out<<std::endl; } }
+    for (iterator it=begin();it!=end();++it) { if (meta!=NULL) meta->addToken(it->first,cb.tell()); out<<it->first<<"\t"; it->second.output(out); out<<std::endl; } }
 };
 
 class MInvert { protected:
@@ -161,28 +162,37 @@ class MInvert { protected:
   }
 
 public:
-  MInvert() { totalpostings=0L; empty=0; pacify=50000; }
+  bool bMath;
+  MInvert() { totalpostings=0L; empty=0; pacify=50000; bMath=false; }
   void setPacify(int p) { pacify=std::max(1,p); }
 
   void input(std::istream& in, cchar* fn) { doIndexTREC(in,fn); }
 
-  void output(std::ostream& out) {
-    out<<"text.mindex.1"<<std::endl;
+  // meta (optional) is filled in the same pass, locations from cb which out writes through
+  void output(std::ostream& out, CountBuf& cb, MMeta* meta) {
+    out<<(bMath?"math":"text")<<".mindex.1"<<std::endl;
     int s=docnames.size(); std::cerr<<"Output "<<s<<" docs, "<<totalpostings<<" totalpostings"<<std::endl;
-    out<<s<<std::endl; for (int i=0;i<s;i++) { out<<docsizes[i]<<"\t"<<docnames[i]<<std::endl; } out<<std::endl;
-    dict.output(out);
+    out<<s<<std::endl; for (int i=0;i<s;i++) { out<<docsizes[i]<<"\t"<<docnames[i]<<std::endl; if (meta!=NULL) meta->addDoc(docnames[i].c_str(),docsizes[i]); } out<<std::endl;
+    dict.output(out,cb,meta);
   }
 };
 
 static void usage() {
-  std::cerr<<"Usage: ./minvert.exe [-p###] datafile ... > out.mindex"<<std::endl;
-  std::cerr<<"       ./minvert.exe [-p###] < datafile > out.mindex"<<std::endl;
-  std::cerr<<" where -p pacifier document count"<<std::endl; exit(-1); }
+  std::cerr<<"Usage: ./minvert.exe [-p###] [-M] [-o out.mindex] datafile ... > out.mindex"<<std::endl;
+  std::cerr<<"       ./minvert.exe [-p###] [-M] [-o out.mindex] < datafile > out.mindex"<<std::endl;
+  std::cerr<<" where -p pacifier document count, -M math (tokenized) input, -o output file and its .meta (no mencode needed)"<<std::endl; exit(-1); }
 
 int main(int argc, char *argv[]) {
   MInvert ms; int s=1;
   if (s<argc && strstr(argv[s],"-p")==argv[s]) { ms.setPacify(std::stoi(argv[s]+2)); s++; }
+  if (s<argc && strstr(argv[s],"-M")==argv[s] && *(argv[s]+2)==0) { ms.bMath=true; s++; }
+  cchar* outfile=NULL; if (s<argc && strcmp(argv[s],"-o")==0) { if (s+1>=argc) usage(); outfile=argv[s+1]; s+=2; }
   if (argc-s==0) { ms.input(std::cin,"stdin"); } else if (argc-s>0) { for (;s<argc;s++) { std::ifstream in(argv[s]); if (!in) usage(); ms.input(in, argv[s]); } } else usage(); // input
-  ms.output(std::cout); // output
+  // output
+  if (outfile==NULL) { CountBuf cb(std::cout.rdbuf()); std::ostream out(&cb); ms.output(out,cb,NULL); return 0; }
+  std::ofstream fout(outfile,std::ios::binary); if (!fout) {std::cerr<<"ERROR: Could not open output file "<<outfile<<std::endl; exit(-1);}
+  MMeta* meta=new MMeta(); uint64_t isize;
+  { CountBuf cb(fout.rdbuf()); std::ostream out(&cb); ms.output(out,cb,meta); cb.pubsync(); isize=cb.tell(); }
+  fout.close(); meta->write(outfile,isize); delete meta;
   return 0;
 }
@@ -0,0 +1,321 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <unistd.h> // for mkstemp, close
+
+#include "mmeta.hpp"
+
+// == merge ======================================================
+// merge mindex files (inline for low memory usage), docids are renumbered in input order
+
+inline static void writeVByte(std::ostream& out, uint v) { byte t[5]; int i=0; for (;;i++) { t[i]=v&0x7F;v>>=7; if(v==0)break; } for (;i>0;i--) {out.put(t[i]|0x80);} out.put(t[i]); }
+inline static uint vbytesize(uint v) { byte t[5]; int i=0; for (;;i++) { t[i]=v&0x7F;v>>=7; if(v==0)break; } return i+1; }
+
+class MIndex { public:
+  class DataH { public: int base,psize,lastid,firstid; byte* d; byte* dend;
+    DataH() { base=0; reset(); }
+    inline void reset() { psize=lastid=firstid=0; d=dend=NULL; }
+    inline void reset(byte* data, int dsize) { d=data; dend=d+dsize; psize=readVByte(d); lastid=readVByte(d); firstid=(psize<=1?lastid:readVByte(d)); }
+  };
+
+  const char* fn; std::ifstream in; int doccount, alldoccount, plcount; //index level, doccount excludes deleted
+  std::shared_ptr<std::vector<int> > remap; //docid->compacted docid (-1 deleted), NULL without deletions
+  std::string token; byte* data; int dalloc; byte* fdata; int falloc; DataH h; //postings list level, fdata for filtered postings
+  bool bMath; std::string endtoken; //stop before endtoken (""=none) for term-range partitions
+  int split; //0 all tokens, 1 text tokens only, 2 math tuples (#...#) only, for math/text sub-indexes
+  struct Sample { std::string token; uint64_t loc; Sample(const std::string& t="", uint64_t l=0) :token(t),loc(l) {} };
+  
+  MIndex(const char* f) : in(f) { fn=f; doccount=alldoccount=plcount=0; split=0; token=""; data=(byte*)malloc(dalloc=1<<20); fdata=NULL; falloc=0;
+    if (!in.is_open()) {std::cerr<<"ERROR: Could not open input file "<<fn<<std::endl; exit(-1);}
+    // decide what type of file
+    std::string line; getline(in, line);
+    if (!in || line.compare("")==0) {std::cerr<<"ERROR: Empty input file "<<fn<<std::endl; exit(-1);}
+    if (line.compare("text.mindex.1")==0) { bMath=false; }
+    else if (line.compare("math.mindex.1")==0) { bMath=true; }
+    else {std::cerr<<"ERROR: Unknown file format in "<<fn<<", found ("<<line<<")."<<std::endl; exit(-1);}
+  }
+
+  virtual ~MIndex() { free(data); data=NULL; if (fdata!=NULL) free(fdata); fdata=NULL; }
+
+  // deleted documents (fn.del) are dropped and the rest renumbered, so doccount and totaltokens only count live documents
+  void read_doccount() { in>>alldoccount; doccount=alldoccount; std::string line; getline(in, line);
+    DeletedDocs del; if (!del.read(fn,alldoccount) || del.deleted()==0) return;
+    remap.reset(new std::vector<int>(alldoccount)); doccount=0;
+    for (int i=0;i<alldoccount;i++) { (*remap)[i]=(del.test(i)?-1:doccount++); }
+    std::cerr<<"Dropping "<<del.deleted()<<" deleted documents from "<<fn<<std::endl;
+  }
+
+  void readwrite_docsizenames(std::ostream& out, MMeta* meta) {
+    for (int i=0;i<alldoccount;i++) { std::string line; getline(in, line); if (remap!=NULL && (*remap)[i]<0) continue; out<<line<<std::endl; //pass through
+      if (meta!=NULL) { size_t t=line.find('\t'); meta->addDoc(line.c_str()+t+1,atoi(line.c_str())); } }
+    std::string line; getline(in, line);
+    if (line.compare("")!=0) { std::cerr<<"ERROR: Invalid index file "<<fn<<", extra document names ("<<line<<")."<<doccount<<std::endl; }
+    //drop newline except for last in index
+  }
+
+  bool read_tokendata() { // tokenname \t bytelength \n bytes
+    for (;;) {
+      in>>token; if (!in||token.compare("")==0||(endtoken.size()>0&&token.compare(endtoken)>=0)) {std::cerr<<"Input "<<plcount<<" postings lists from "<<fn<<std::endl; return false;}
+      uint dsize; in>>dsize;
+      { std::string line; getline(in, line); if (line.compare("")!=0) {std::cerr<<"ERROR: Invalid index file "<<fn<<", extra postings info for "<<token<<"."<<std::endl; exit(-1);} }
+      //read vbyte data
+      while (dsize>dalloc) { data=(byte*)realloc(data,dalloc*=2); } //grow
+      in.read((char*)data,dsize);
+      if (split!=0 && isMathTuple(token.c_str())!=(split==2)) { std::string line; getline(in, line); continue; } // other sub-index
+      if (!isVBytePL(data)) dsize=expand(dsize); // merged as VByte, AccumH decides the output encoding
+      if (remap==NULL) { h.reset(data,dsize); return true; }
+      byte* f; int fsize=filter(dsize,f); if (fsize>0) { h.reset(f,fsize); return true; }
+      std::string line; getline(in, line); // all postings deleted, skip list
+    }
+  }
+
+  // bitmap or Elias-Fano postings in data to VByte psize [lastid] (delta-id,freq)+, returns new size
+  int expand(int dsize) { std::vector<byte> v; uint n=0, last=0; v.resize(20);
+    forPostings(data,data+dsize,[&](uint id, uint freq) { size_t s=v.size(); v.resize(s+20); byte* o=&v[s]; writeVByte(o,id-last); writeVByte(o,freq); v.resize(o-&v[0]); last=id; n++; });
+    byte hb[20]; byte* x=hb; writeVByte(x,n); if (n>1) writeVByte(x,last); size_t h=x-hb, size=v.size()-20+h;
+    while (size>dalloc) { data=(byte*)realloc(data,dalloc*=2); } //grow
+    memcpy(data,hb,h); memcpy(data+h,&v[20],v.size()-20); return size;
+  }
+
+  // drop deleted docids and renumber, same encoding: psize [lastid] (delta-id,freq)+, returns 0 if none left
+  int filter(int dsize, /*out*/byte*& f) {
+    if (falloc<dsize+20) { falloc=std::max(2*falloc,dsize+20); fdata=(byte*)realloc(fdata,falloc); }
+    byte* d=data; byte* dend=data+dsize; uint psize=readVByte(d); if (psize>1) readVByte(d);
+    byte* o=fdata+20; uint n=0, id=0, last=0; // pairs after room for the header
+    for (uint i=0;i<psize;i++) { id+=readVByte(d); uint freq=readVByte(d); int nid=(*remap)[id];
+      if (nid<0) continue; writeVByte(o,nid-last); writeVByte(o,freq); last=nid; n++; }
+    if (d!=dend) {std::cerr<<"ERROR: Invalid index file "<<fn<<", postings size for "<<token<<"."<<std::endl; exit(-1);}
+    if (n==0) return 0;
+    byte hb[20]; byte* x=hb; writeVByte(x,n); if (n>1) writeVByte(x,last);
+    f=fdata+20-(x-hb); memcpy(f,hb,x-hb); return o-f;
+  }
+
+  // header-only scan keeping every stride-th token location, stride doubles to bound memory
+  void sample_tokens(/*out*/std::vector<Sample>& s) {
+    uint stride=1;
+    for (uint64_t n=0;;n++) {
+      uint64_t loc=in.tellg(); std::string t; in>>t; if (!in||t.compare("")==0) break;
+      uint dsize; in>>dsize; in.seekg(dsize+2,std::ios::cur); // \n bytes \n
+      if (n%stride!=0) continue;
+      s.push_back(Sample(t,loc));
+      if (s.size()>=(1<<16)) { for (int i=0;i<s.size()/2;i++) s[i]=s[2*i]; s.resize(s.size()/2); stride*=2; } //thin
+    }
+    in.clear();
+  }
+
+  // position at first token>=start, starting from closest sample before it
+  void seek_tokens(uint64_t loc, const std::vector<Sample>& s, const std::string& start) {
+    for (int i=0;i<s.size()&&s[i].token.compare(start)<0;i++) loc=s[i].loc;
+    in.seekg(loc);
+    for (;;) { loc=in.tellg(); std::string t; in>>t; if (!in||t.compare(start)>=0) break;
+      uint dsize; in>>dsize; in.seekg(dsize+2,std::ios::cur); }
+    in.clear(); in.seekg(loc);
+  }
+
+  void read_endofpostings(std::ostream& out) {
+    { std::string line; getline(in, line); if (line.compare("")!=0) {std::cerr<<"ERROR: Invalid index file "<<fn<<", extra postings for "<<token<<"."<<std::endl; exit(-1);} }
+    plcount++;
+  }
+};
+
+class AccumH { public: std::vector<MIndex::DataH*> dh; std::vector<uint> deltaid; uint psize,lastid; PLFormat fmt; std::string coded; //coded: list as bitmap or Elias-Fano
+  uint64_t lists[3], bytes[3]; //per encoding: VByte, bitmap, Elias-Fano
+  AccumH(const PLFormat& f=PLFormat()) : fmt(f) { reset(); psize=-1; for (int i=0;i<3;i++) { lists[i]=bytes[i]=0; } }
+  inline void reset() { dh.clear(); }
+  inline void add(MIndex::DataH& h) { dh.push_back(&h); }
+  inline uint encodesetup() {
+    deltaid.clear(); psize=lastid=0; uint blen=0;
+    for (int i=0;i<dh.size();i++) { MIndex::DataH& h=*dh[i];
+      psize+=h.psize;
+      uint id=h.firstid+h.base-lastid; deltaid.push_back(id);
+      blen+=vbytesize(id)+(h.dend-h.d);
+      lastid=h.lastid+h.base;
+    }
+    coded.clear();
+    bool bBitmap=(dh.size()>0 && useBitmap(psize,dh[0]->firstid+dh[0]->base,lastid,fmt.density)), bPEF=(fmt.bPEF && psize>=PEFMinPostings);
+    if (bBitmap || bPEF) { std::vector<uint> ids, freqs; // dense list as bitmap, else Elias-Fano
+      for (int i=0;i<dh.size();i++) { MIndex::DataH& h=*dh[i]; uint id=h.firstid+h.base; byte* d=h.d; ids.push_back(id); freqs.push_back(readVByte(d));
+        for (;d<h.dend;) { id+=readVByte(d); ids.push_back(id); freqs.push_back(readVByte(d)); } }
+      if (bBitmap) BitmapPL::encode(ids,freqs,coded); else PEFList::encode(ids,freqs,coded);
+      lists[bBitmap?1:2]++; bytes[bBitmap?1:2]+=coded.size(); return coded.size(); }
+    blen+=vbytesize(psize) + (psize>1?vbytesize(lastid):0); lists[0]++; bytes[0]+=blen;
+    return blen;
+  }
+  inline void encode(std::ostream& out) {
+    if (psize==-1) {std::cerr<<"ERROR: encode called before encodesetup."<<std::endl; exit(-1);}
+    if (coded.size()>0) { out.write(coded.data(),coded.size()); reset(); lastid=-1; return; }
+    writeVByte(out,psize); if (psize>1) writeVByte(out,lastid);
+    for (int i=0;i<dh.size();i++) { MIndex::DataH& h=*dh[i]; writeVByte(out,deltaid[i]); out.write((char*)h.d,h.dend-h.d); }
+    reset(); lastid=-1;
+  }
+};
+
+// locs (MMeta or TokenLocs, optional) collects token locations from cb which out writes through
+// lists with psize>=density*(lastid-firstid+1) are written as bitmaps, other long lists as Elias-Fano with fmt.bPEF
+template <class L> void outputPostings(std::ostream& out, std::vector<MIndex*> ui, CountBuf& cb, L* locs, const PLFormat& fmt) {
+  int size=ui.size();
+  // setup first tokens
+  for (int k=0;k<size;) {
+    if (!ui[k]->in || !ui[k]->read_tokendata()) { /*bubbleup*/ for (int j=k+1;j<size;j++) { std::swap(ui[j],ui[j-1]); } size--; continue; } //done index file
+    k++;
+  }
+  AccumH h(fmt);
+  for (;size>0;) {
+    // find 'lowest' token
+    std::string token=ui[0]->token; h.reset(); h.add(ui[0]->h);
+    for (int k=1;k<size;k++) {
+      int sm = ui[k]->token.compare(token);
+      if (sm < 0) { token=ui[k]->token; h.reset(); h.add(ui[k]->h); }
+      else if (sm == 0) { h.add(ui[k]->h); }
+    }
+    // output 'lowest' token
+    if (locs!=NULL) locs->addToken(token.c_str(),cb.tell());
+    out<<token<<"\t"<<h.encodesetup()<<std::endl;
+    h.encode(out);
+    // advance all lists for 'lowest' token
+    for (int k=0;k<size;) {
+      if (ui[k]->token.compare(token)==0) {
+        ui[k]->read_endofpostings(out);
+        // get next tokens
+        if (!ui[k]->in || !ui[k]->read_tokendata()) { /*bubbleup*/ for (int j=k+1;j<size;j++) { std::swap(ui[j],ui[j-1]); } size--; continue; } //done index file
+      }
+      k++;
+    }
+    out<<std::endl;
+  }
+  if (fmt.density>0.0 || fmt.bPEF) std::cerr<<"Encoded lists: VByte "<<h.lists[0]<<" ("<<h.bytes[0]<<" bytes), bitmap "<<h.lists[1]<<" ("<<h.bytes[1]<<" bytes), Elias-Fano "<<h.lists[2]<<" ("<<h.bytes[2]<<" bytes)"<<std::endl;
+}
+
+// term-range partitions merged in parallel into temporary parts, then concatenated in order
+void outputParallel(std::ostream& out, std::vector<MIndex*>& ui, int threads, CountBuf& cb, MMeta* meta, const PLFormat& fmt) {
+  int size=ui.size(); std::vector<uint64_t> start(size);
+  for (int k=0;k<size;k++) { start[k]=ui[k]->in.tellg(); }
+  // sample term space (one thread per input)
+  std::vector<std::vector<MIndex::Sample> > samples(size);
+  { std::vector<std::thread> t;
+    for (int k=0;k<size;k++) { t.push_back(std::thread([&,k]() { MIndex m(ui[k]->fn); m.in.seekg(start[k]); m.sample_tokens(samples[k]); })); }
+    for (int k=0;k<size;k++) { t[k].join(); } }
+  std::vector<std::string> all;
+  for (int k=0;k<size;k++) { for (int i=0;i<samples[k].size();i++) all.push_back(samples[k][i].token); }
+  sort(all.begin(),all.end()); all.erase(unique(all.begin(),all.end()),all.end());
+  if (all.size()<2) { outputPostings(out,ui,cb,meta,fmt); return; } // too few terms to split
+  // split into ranges [splits[p],splits[p+1]) with ""=open
+  std::vector<std::string> splits; splits.push_back("");
+  for (int p=1;p<threads;p++) { std::string s=all[(uint64_t)p*all.size()/threads]; if (s.compare(splits.back())>0) splits.push_back(s); }
+  splits.push_back("");
+  int parts=splits.size()-1; std::cerr<<"Output postings in "<<parts<<" parts."<<std::endl;
+  // merge each range into a temporary part
+  std::string tmpdir=(getenv("TMPDIR")!=NULL?getenv("TMPDIR"):"/tmp");
+  std::vector<std::string> pfn(parts); std::vector<uint64_t> psize(parts); std::vector<TokenLocs> plocs(parts);
+  std::vector<std::thread> t;
+  for (int p=0;p<parts;p++) {
+    std::string f=tmpdir+"/mmerge.part.XXXXXX"; std::vector<char> c(f.begin(),f.end()); c.push_back('\0');
+    int fd=mkstemp(c.data()); if (fd<0) {std::cerr<<"ERROR: Could not create temporary file "<<f<<std::endl; exit(-1);} close(fd); pfn[p]=c.data();
+    t.push_back(std::thread([&,p]() {
+      std::vector<MIndex*> pi;
+      for (int k=0;k<size;k++) { MIndex* m=new MIndex(ui[k]->fn); m->h.base=ui[k]->h.base; m->doccount=ui[k]->doccount; m->alldoccount=ui[k]->alldoccount; m->remap=ui[k]->remap; m->split=ui[k]->split;
+        m->seek_tokens(start[k],samples[k],splits[p]); m->endtoken=splits[p+1]; pi.push_back(m); }
+      std::ofstream pout(pfn[p],std::ios::binary);
+      { CountBuf pcb(pout.rdbuf()); std::ostream o(&pcb); outputPostings(o,pi,pcb,(meta!=NULL?&plocs[p]:NULL),fmt); pcb.pubsync(); psize[p]=pcb.tell(); }
+      pout.close();
+      for (int k=0;k<size;k++) { delete pi[k]; }
+    }));
+  }
+  for (int p=0;p<parts;p++) { t[p].join(); }
+  // concatenate
+  for (int p=0;p<parts;p++) {
+    if (meta!=NULL) plocs[p].addto(*meta,cb.tell());
+    if (psize[p]>0) { std::ifstream pin(pfn[p],std::ios::binary); out<<pin.rdbuf(); }
+    remove(pfn[p].c_str());
+  }
+}
+
+// meta (optional) is filled in the same pass, locations from cb which out writes through
+void output(std::ostream& out, std::vector<MIndex*>& ui, int threads, CountBuf& cb, MMeta* meta, const PLFormat& fmt=PLFormat()) { // uncompressed
+  int size=ui.size();
+  // format
+  for (int k=1;k<size;k++) { if (ui[k]->bMath!=ui[0]->bMath) {std::cerr<<"ERROR: Inconsistent file formats."<<std::endl; exit(-1);} }
+  out<<(ui[0]->bMath?"math":"text")<<".mindex.1"<<std::endl;
+  // doccount
+  int base=0;
+  for (int k=0;k<size;k++) { ui[k]->h.base=base; ui[k]->read_doccount(); base+=ui[k]->doccount; }
+  std::cerr<<"Output "<<base<<" document names."<<std::endl;
+  out<<base<<std::endl;
+
+  // size+docnames
+  for (int k=0;k<size;k++) { ui[k]->readwrite_docsizenames(out,meta); } out<<std::endl; //end with newline
+
+  // postings
+  std::cerr<<"Output postings."<<std::endl;
+  if (threads>1) outputParallel(out,ui,threads,cb,meta,fmt); else outputPostings(out,ui,cb,meta,fmt);
+}
+
+// merge input files into outfile and its .meta (used by mmerge -o and mseg), split selects the tokens of a math/text sub-index
+void mergeFiles(const std::vector<std::string>& fns, cchar* outfile, int threads, const PLFormat& fmt=PLFormat(), int split=0) {
+  std::vector<MIndex*> ui;
+  for (int i=0;i<fns.size();i++) { std::cerr<<"Input "<<fns[i]<<std::endl; ui.push_back(new MIndex(fns[i].c_str())); ui.back()->split=split; }
+  std::ofstream fout(outfile,std::ios::binary); if (!fout) {std::cerr<<"ERROR: Could not open output file "<<outfile<<std::endl; exit(-1);}
+  MMeta* meta=new MMeta(); uint64_t isize;
+  { CountBuf cb(fout.rdbuf()); std::ostream out(&cb); output(out,ui,threads,cb,meta,fmt); cb.pubsync(); isize=cb.tell(); }
+  fout.close(); meta->write(outfile,isize); delete meta;
+  for (int k=0;k<ui.size();k++) { delete ui[k]; }
+}
+
+// == MIndexData ======================================================
+// a whole mindex in memory (document lines, (docid,freq) postings per token) for tools rewriting every list (mreorder, mprune),
+// deleted documents dropped and docids compacted as in mmerge
+
+class MIndexData { public:
+  bool bMath; std::vector<std::string> docs; std::vector<uint> docsizes; uint64_t totaltokens; //docs: docsize \t docname lines
+  std::vector<std::string> tokens; std::vector<uint64_t> start; std::vector<uint> ids, freqs; //postings of token t in [start[t],start[t+1])
+  MIndexData() { bMath=false; totaltokens=0; }
+
+  inline uint doccount() const { return docs.size(); }
+  inline uint64_t df(int t) const { return start[t+1]-start[t]; }
+
+  // any list encoding
+  void read(cchar* fn) {
+    MIndex m(fn); bMath=m.bMath; m.read_doccount();
+    { std::stringstream ss; m.readwrite_docsizenames(ss,NULL); for (std::string line;getline(ss,line);) { docs.push_back(line); docsizes.push_back(atoi(line.c_str())); totaltokens+=docsizes.back(); } }
+    if (docs.size()!=m.doccount) {std::cerr<<"ERROR: Invalid index file "<<fn<<", document names"<<std::endl; exit(-1);}
+    start.push_back(0);
+    for (;m.in && m.read_tokendata();) { MIndex::DataH& h=m.h; uint id=h.firstid; byte* d=h.d; ids.push_back(id); freqs.push_back(readVByte(d));
+      for (;d<h.dend;) { id+=readVByte(d); ids.push_back(id); freqs.push_back(readVByte(d)); }
+      tokens.push_back(m.token); start.push_back(ids.size()); m.read_endofpostings(std::cout); }
+    std::cerr<<"Input "<<docs.size()<<" documents, "<<tokens.size()<<" postings lists, "<<ids.size()<<" postings"<<std::endl;
+  }
+
+  // VByte mindex and .meta of the postings with keep[i] (all when empty) under docid map nid (old->new, identity when empty),
+  // documents in new docid order, lists left without postings are dropped (meta may already hold stats for the written lists)
+  void write(cchar* outfn, const std::vector<uint>& nid, const std::vector<bool>& keep, MMeta& meta) { uint n=docs.size();
+    std::vector<uint> order(n); for (uint d=0;d<n;d++) { order[nid.size()>0?nid[d]:d]=d; }
+    std::ofstream fout(outfn,std::ios::binary); if (!fout) {std::cerr<<"ERROR: Could not open output file "<<outfn<<std::endl; exit(-1);}
+    uint64_t isize;
+    { CountBuf cb(fout.rdbuf()); std::ostream out(&cb);
+      out<<(bMath?"math":"text")<<".mindex.1"<<std::endl<<n<<std::endl;
+      for (uint d=0;d<n;d++) { const std::string& line=docs[order[d]]; out<<line<<std::endl; size_t t=line.find('\t'); meta.addDoc(line.c_str()+t+1,docsizes[order[d]]); }
+      out<<std::endl;
+      std::vector<std::pair<uint,uint> > v; std::vector<byte> b;
+      for (int t=0;t<tokens.size();t++) { v.clear();
+        for (uint64_t i=start[t];i<start[t+1];i++) { if (keep.size()==0 || keep[i]) v.push_back(std::make_pair(nid.size()>0?nid[ids[i]]:ids[i],freqs[i])); }
+        if (v.size()==0) continue;
+        std::sort(v.begin(),v.end()); b.resize(20+10*v.size()); byte* x=b.data();
+        writeVByte(x,v.size()); if (v.size()>1) writeVByte(x,v.back().first);
+        for (int i=0;i<v.size();i++) { writeVByte(x,v[i].first-(i==0?0:v[i-1].first)); writeVByte(x,v[i].second); }
+        meta.addToken(tokens[t].c_str(),cb.tell());
+        out<<tokens[t]<<"\t"<<(x-b.data())<<std::endl; out.write((cchar*)b.data(),x-b.data()); out<<std::endl; }
+      cb.pubsync(); isize=cb.tell(); }
+    fout.close(); meta.write(outfn,isize);
+  }
+};
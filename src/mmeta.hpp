@@ -0,0 +1,150 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <algorithm>
+#include <cmath> // for log()
+#include <stdio.h> // for rename
+#include <sys/stat.h>
+
+#include "mdictionary.hpp"
+#include "mpostings.hpp"
+
+// math tuple token (#...#) of a math index, weighted by alpha against text tokens
+inline static bool isMathTuple(cchar* token) { return token[0]=='#'; }
+
+// == scoring policies ======================================================
+// BM25 variants with constexpr parameters, instantiated into the msearch query loops:
+//   k1, b length normalization (norm per document precomputed by the index, so a posting costs one divide), delta lower bound of the tf part (BM25+),
+//   bMath alpha weighting of math tuple against text query terms; all share k1 and b with BM25 (one norms table)
+
+struct BM25 { static constexpr float k1=1.2f, b=0.75f, delta=0.0f; static constexpr bool bMath=false; };
+struct BM25Plus : BM25 { static constexpr float delta=1.0f; };
+struct BM25Math : BM25 { static constexpr bool bMath=true; };
+struct BM25PlusMath : BM25Plus { static constexpr bool bMath=true; };
+
+template <class P> struct Scorer {
+  static inline float norm(uint64_t docsize, float avgDocSize) { return P::k1*(1.0f - P::b + P::b*docsize/avgDocSize); }
+  static inline float tf(float freq, float norm) { float t=freq*(P::k1+1.0f) / (freq + norm); return (P::delta!=0.0f?t+P::delta:t); }
+  static constexpr float maxtf() { return P::k1+1.0f; } // tf part bound without term stats (before delta)
+  static inline float weight(cchar* token, float w, float alpha) { return (!P::bMath?w:w*(isMathTuple(token)?alpha:1.0f-alpha)); }
+};
+
+// BM25 term frequency component (k1=1.2, b=0.75), same float result as the msearch query loops
+inline static float bm25tf(float freq, uint64_t docsize, float avgDocSize) { return Scorer<BM25>::tf(freq,Scorer<BM25>::norm(docsize,avgDocSize)); }
+
+// BM25 inverse document frequency (double, as msearch multiplies it into float query weights)
+inline static double bm25idf(int doccount, int df) { return log(1.0f+((float)doccount-df+0.5f)/(df+0.5f)); }
+
+// per-term statistics (in dictionary order) for query-time upper bounds
+struct TermStat { uint maxtf; float maxbm25tf; };
+static const cchar* TermStatsName="TermStats";
+static const cchar* TermDFsName="TermDFs"; //document frequencies of the unpruned lists (mprune), so BM25 idf is unchanged
+
+// == MMeta ======================================================
+// mindex.meta contents: index file size, docs(docname->docsize), totaltokens, dict(token->location), [stats], [dfs]
+// built in index order by mencode (rescan) or directly by minvert/mmerge (single pass)
+
+class MMeta { protected: std::string lastdoc, lasttoken; bool ended;
+public:
+  DocnamesTwoLayer docs; uint64_t totaltokens; DictionaryTwoLayer dict; std::vector<TermStat> stats; std::vector<uint> dfs; //stats, dfs optional
+  MMeta() { totaltokens=0L; ended=false; }
+  inline void addDoc(cchar* docname, int docsize) { docs.add(docname,lastdoc.c_str(),docsize); totaltokens+=docsize; lastdoc=docname; }
+  inline void addToken(cchar* token, uint64_t loc) { dict.add(token,lasttoken.c_str(),loc); lasttoken=token; } // point to (token \t bytelength \n data)
+  inline void addEnd() { if (ended) return; docs.addEnd(); dict.addEnd(); ended=true;
+    std::cerr<<"dictionary "<<dict.memoryusage()<<" bytes "<<(double)dict.memoryusage()/std::max(1u,dict.size())<<" b/entry"<<std::endl; }
+  // isize is the expected index file size when known by the writer, written to a tmp file then renamed so readers never see a partial .meta
+  void write(cchar* fn, uint64_t isize=(uint64_t)-1) { addEnd();
+    struct stat sb; int er=stat(fn,&sb); uint64_t fsize=(uint64_t)sb.st_size;
+    if (er==-1 || (isize!=(uint64_t)-1 && isize!=fsize)) {std::cerr<<"ERROR: index "<<fn<<" size "<<fsize<<" expected "<<isize<<std::endl; exit(-1);}
+    std::string metafn=(std::string)fn+".meta", tmp=metafn+".tmp"; std::ofstream out(tmp);
+    if (!out) {std::cerr<<"ERROR: Could not write "<<tmp<<std::endl; exit(-1);}
+    out<<fsize<<std::endl; // index file size to ensure correct pairing
+    docs.write(out); out<<totaltokens<<std::endl; dict.write(out);
+    if (stats.size()>0) { out<<TermStatsName<<std::endl<<stats.size()<<std::endl; out.write((cchar*)stats.data(),stats.size()*sizeof(TermStat)); out<<std::endl; }
+    if (dfs.size()>0) { out<<TermDFsName<<std::endl<<dfs.size()<<std::endl; out.write((cchar*)dfs.data(),dfs.size()*sizeof(uint)); out<<std::endl; }
+    out.close(); if (!out) {std::cerr<<"ERROR: Could not write "<<tmp<<std::endl; exit(-1);}
+    if (rename(tmp.c_str(),metafn.c_str())!=0) {std::cerr<<"ERROR: Could not replace "<<metafn<<std::endl; exit(-1);}
+  }
+  // whole .meta structure present (sizes, both dictionaries, optional sections), no exit, for reloading while files are replaced
+  static bool complete(std::ifstream& in) { std::string line; uint64_t t;
+    if (!(in>>t) || !getline(in,line) || line.compare("")!=0 || !skipTwoLayer(in,"DocnamesTwoLayer")) return false;
+    if (!(in>>t) || !getline(in,line) || line.compare("")!=0 || !skipTwoLayer(in,"DictionaryTwoLayer")) return false;
+    for (;;) { if (!getline(in,line)) return in.eof() && line.compare("")==0;
+      bool bStats=(line.compare(TermStatsName)==0); uint64_t n;
+      if ((!bStats && line.compare(TermDFsName)!=0) || !(in>>n) || !getline(in,line) || line.compare("")!=0) return false;
+      in.seekg(n*(bStats?sizeof(TermStat):sizeof(uint)),std::ios::cur); if (!getline(in,line) || line.compare("")!=0) return false; }
+  }
+  // type line, sizes, skips and data of a BaseTwoLayer as written by its write()
+  static bool skipTwoLayer(std::ifstream& in, cchar* type) { std::string line; uint64_t slen, dlen, skipsize, dictsize;
+    if (!getline(in,line) || line.compare(type)!=0 || !(in>>slen>>dlen>>skipsize>>dictsize) || !getline(in,line) || line.compare("")!=0) return false;
+    in.seekg(slen*sizeof(uint),std::ios::cur); if (!getline(in,line) || line.compare("")!=0) return false;
+    in.seekg(dlen,std::ios::cur); return getline(in,line) && line.compare("")==0;
+  }
+  // optional sections after dict (per term in dict order), left empty if not present
+  static void readSections(std::ifstream& in, cchar* fn, uint dictsize, /*out*/std::vector<TermStat>& stats, std::vector<uint>& dfs) { std::string line;
+    for (;;) { getline(in,line); if (!in) return;
+      bool bStats=(line.compare(TermStatsName)==0);
+      if (!bStats && line.compare(TermDFsName)!=0) {std::cerr<<"ERROR: meta "<<fn<<" unknown section "<<line<<std::endl; exit(-1);}
+      uint n; in>>n; getline(in,line); if (line.compare("")!=0 || n!=dictsize) {std::cerr<<"ERROR: meta "<<fn<<" section size "<<n<<" "<<line<<std::endl; exit(-1);}
+      if (bStats) { stats.resize(n); in.read((char*)stats.data(),n*sizeof(TermStat)); } else { dfs.resize(n); in.read((char*)dfs.data(),n*sizeof(uint)); }
+      getline(in,line); if (line.compare("")!=0) {std::cerr<<"ERROR: meta "<<fn<<" section data "<<line<<std::endl; exit(-1);}
+    }
+  }
+};
+
+// token locations collected out of order (e.g. by parallel parts), added to MMeta in order with a base
+class TokenLocs { protected: std::string d; std::vector<uint64_t> locs; public:
+  inline void addToken(cchar* token, uint64_t loc) { d.append(token,strlen(token)+1); locs.push_back(loc); }
+  inline void addto(MMeta& meta, uint64_t base) { cchar* t=d.c_str(); for (int i=0;i<locs.size();i++) { meta.addToken(t,base+locs[i]); t+=strlen(t)+1; } }
+};
+
+// large output buffer counting bytes written, so locations are known without tellp (which flushes)
+class CountBuf : public std::streambuf { protected: std::streambuf* sb; uint64_t count; std::vector<char> b;
+public:
+  CountBuf(std::streambuf* s, int bsize=1<<20) : sb(s), count(0), b(bsize) { setp(b.data(),b.data()+b.size()); }
+  virtual ~CountBuf() { sync(); }
+  inline uint64_t tell() { return count+(pptr()-pbase()); }
+protected:
+  virtual int overflow(int c) { if (sync()!=0) return EOF; if (c!=EOF) { *pptr()=c; pbump(1); } return (c==EOF?0:c); }
+  virtual std::streamsize xsputn(const char* s, std::streamsize n) {
+    if (n>=b.size()) { if (sync()!=0) return 0; std::streamsize w=sb->sputn(s,n); count+=w; return w; } //large write direct
+    return std::streambuf::xsputn(s,n); }
+  virtual int sync() { int n=pptr()-pbase(); if (n>0 && sb->sputn(pbase(),n)!=n) return -1; count+=n; setp(b.data(),b.data()+b.size()); return sb->pubsync(); }
+};
+
+// == DeletedDocs ======================================================
+// tombstone bitmap over the docids of one mindex (fn.del), skipped by msearch and dropped by mmerge
+
+static const cchar* DeletedName="mindex.deleted.1";
+
+class DeletedDocs { protected: std::vector<uint64_t> w; uint n, count;
+public:
+  DeletedDocs(uint size=0) { resize(size); }
+  inline void resize(uint size) { n=size; w.assign((size+63)/64,0); count=0; }
+  inline uint size() const { return n; }
+  inline uint deleted() const { return count; }
+  inline bool test(uint id) const { return (w[id>>6]>>(id&63))&1; }
+  inline void set(uint id) { if (!test(id)) { w[id>>6]|=1ull<<(id&63); count++; } }
+  inline void add(const DeletedDocs& o, uint base) { for (uint i=0;i<o.w.size();i++) { for (uint64_t b=o.w[i];b!=0;b&=b-1) { set(base+i*64+__builtin_ctzll(b)); } } }
+  // fn is the mindex file, false (none deleted) if there is no fn.del
+  bool read(cchar* fn, uint doccount) { resize(doccount); std::string dfn=(std::string)fn+".del", line;
+    std::ifstream in(dfn); if (!in) return false;
+    getline(in,line); if (line.compare(DeletedName)!=0) {std::cerr<<"ERROR: Unknown file format "<<dfn<<" "<<line<<std::endl; exit(-1);}
+    uint s; in>>s>>count; getline(in,line); if (s!=doccount || line.compare("")!=0) {std::cerr<<"ERROR: deleted "<<dfn<<" size "<<s<<" expected "<<doccount<<std::endl; exit(-1);}
+    in.read((char*)w.data(),w.size()*sizeof(uint64_t));
+    getline(in,line); if (!in || line.compare("")!=0) {std::cerr<<"ERROR: deleted "<<dfn<<" data "<<line<<std::endl; exit(-1);}
+    return true;
+  }
+  void write(cchar* fn) { std::string dfn=(std::string)fn+".del", tmp=dfn+".tmp";
+    { std::ofstream out(tmp); out<<DeletedName<<std::endl<<n<<"\t"<<count<<std::endl; out.write((cchar*)w.data(),w.size()*sizeof(uint64_t)); out<<std::endl;
+      out.close(); if (!out) {std::cerr<<"ERROR: Could not write "<<tmp<<std::endl; exit(-1);} }
+    if (rename(tmp.c_str(),dfn.c_str())!=0) {std::cerr<<"ERROR: Could not replace "<<dfn<<std::endl; exit(-1);} // readers see old or new
+  }
+};
@@ -0,0 +1,119 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <string>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+// uses byte and VByte functions, so include after mdictionary.hpp
+
+// postings list encodings besides VByte psize [lastid] (delta-id,freq)+, told apart by a first byte VByte never writes
+inline static uint64_t loadWord(cbyte* d) { uint64_t w; memcpy(&w,d,8); return w; }
+inline static uint64_t getBits(cbyte* d, uint64_t b, uint bits) { return (loadWord(d+(b>>3))>>(b&7))&((1ull<<bits)-1); } // bits<=56
+inline static void putBits(std::vector<byte>& v, uint64_t b, uint64_t x) { uint64_t w=loadWord(&v[b>>3]); w|=x<<(b&7); memcpy(&v[b>>3],&w,8); } // v padded by 8
+inline static uint bitsFor(uint maxv) { uint b=0; for (;(maxv>>b)!=0;b++) {} return b; }
+
+// list encodings written by mmerge (-b bitmap density, -e partitioned Elias-Fano)
+struct PLFormat { double density; bool bPEF; PLFormat(double d=0.0, bool e=false) :density(d),bPEF(e) {} };
+
+// == bitmap postings ======================================================
+// dense postings lists as a docid bitmap with rank samples and packed freqs instead of VByte (delta-id,freq) pairs:
+//   0 (never a VByte psize), psize, firstid, nwords (VByte), fbits (byte),
+//   nwords 64-bit words (bit i is docid firstid+i), uint32 set bits before each 8 word block, psize fbits-bit (freq-1) values, 8 pad bytes
+
+static const byte BitmapFlag=0;
+static const uint BitmapMinPostings=64; //shorter lists stay VByte
+
+inline static bool isBitmapPL(cbyte* d) { return *d==BitmapFlag; }
+inline static bool useBitmap(uint psize, uint firstid, uint lastid, double density) { return density>0.0 && psize>=BitmapMinPostings && psize>=density*((double)lastid-firstid+1); }
+
+struct BitmapPL { uint psize, firstid, nwords, fbits; cbyte* words; cbyte* ranks; cbyte* freqs;
+  BitmapPL() { psize=firstid=nwords=fbits=0; words=ranks=freqs=NULL; }
+  BitmapPL(byte* d) { d++; psize=readVByte(d); firstid=readVByte(d); nwords=readVByte(d); fbits=*d++;
+    words=d; ranks=words+8*(uint64_t)nwords; freqs=ranks+4*(uint64_t)((nwords+7)/8); }
+  inline cbyte* end() const { return freqs+((uint64_t)psize*fbits+7)/8+8; }
+  inline uint64_t word(uint w) const { return loadWord(words+8*(uint64_t)w); }
+  inline uint freq(uint i) const { return getBits(freqs,(uint64_t)i*fbits,fbits)+1; }
+  // set bits in words before w
+  inline uint rank(uint w) const { uint32_t r; memcpy(&r,ranks+4*(w>>3),4); for (uint i=w&~7u;i<w;i++) { r+=__builtin_popcountll(word(i)); } return r; }
+
+  // ids ascending (local to the list's index), freqs>=1
+  static void encode(const std::vector<uint>& ids, const std::vector<uint>& freqs, /*out*/std::string& out) {
+    uint n=ids.size(), first=ids[0], nwords=(ids.back()-first)/64+1, fbits=bitsFor(*std::max_element(freqs.begin(),freqs.end())-1);
+    byte hb[32]; byte* x=hb; *x++=BitmapFlag; writeVByte(x,n); writeVByte(x,first); writeVByte(x,nwords); *x++=fbits;
+    std::vector<uint64_t> words(nwords,0); for (uint i=0;i<n;i++) { uint b=ids[i]-first; words[b>>6]|=1ull<<(b&63); }
+    std::vector<uint32_t> ranks((nwords+7)/8); uint32_t r=0; for (uint w=0;w<nwords;w++) { if ((w&7)==0) ranks[w>>3]=r; r+=__builtin_popcountll(words[w]); }
+    std::vector<byte> f(((uint64_t)n*fbits+7)/8+8,0); for (uint i=0;i<n && fbits>0;i++) { putBits(f,(uint64_t)i*fbits,freqs[i]-1); }
+    out.assign((cchar*)hb,x-hb); out.append((cchar*)words.data(),8*words.size()); out.append((cchar*)ranks.data(),4*ranks.size()); out.append((cchar*)f.data(),f.size());
+  }
+};
+
+// == partitioned Elias-Fano postings ======================================================
+// docids Elias-Fano coded in partitions of 128 (low bits array, unary high bits), freqs in a separate packed stream per partition:
+//   0x80 (never the first byte of a VByte), psize, nparts (VByte), uint32 last docid per partition, uint32 offset per partition,
+//   partition: l, fbits (bytes), n l-bit lows, upper bits (bit ((id-lo)>>l)+i set, lo is the previous partition's last+1), n fbits-bit (freq-1) values;
+//   8 pad bytes
+
+static const byte PEFFlag=0x80;
+static const uint PEFPart=128, PEFMinPostings=128; //partition size, shorter lists stay VByte
+
+inline static bool isPEF(cbyte* d) { return *d==PEFFlag; }
+
+struct PEFList { uint psize, nparts; cbyte* lasts; cbyte* offs; cbyte* parts;
+  PEFList() { psize=nparts=0; lasts=offs=parts=NULL; }
+  PEFList(byte* d) { d++; psize=readVByte(d); nparts=readVByte(d); lasts=d; offs=lasts+4*(uint64_t)nparts; parts=offs+4*(uint64_t)nparts; }
+  inline uint last(uint p) const { uint32_t v; memcpy(&v,lasts+4*(uint64_t)p,4); return v; }
+  inline uint lo(uint p) const { return (p==0?0:last(p-1)+1); }
+  inline uint count(uint p) const { return (p+1<nparts?PEFPart:psize-PEFPart*(nparts-1)); }
+  inline cbyte* part(uint p) const { uint32_t o; memcpy(&o,offs+4*(uint64_t)p,4); return parts+o; }
+  // first partition from p whose last docid is >=t (nparts if none), galloping
+  inline uint find(uint p, uint t) const { if (p>=nparts || last(nparts-1)<t) return nparts;
+    uint step=1, lo=p; for (;lo+step<nparts && last(lo+step)<t;step*=2) { lo+=step; } uint hi=std::min(lo+step,nparts-1);
+    if (last(lo)>=t) return lo; for (;hi-lo>1;) { uint m=(lo+hi)/2; if (last(m)<t) lo=m; else hi=m; } return hi; }
+  static inline uint lowBits(uint n, uint u) { uint l=0; for (;((uint64_t)n<<(l+1))<=u;l++) {} return l; } // floor(log2(u/n))
+  static inline uint64_t partSize(uint n, uint l, uint fbits, uint span) { return 2+((uint64_t)n*l+7)/8+((uint64_t)n+(span>>l)+1+7)/8+((uint64_t)n*fbits+7)/8; }
+  inline cbyte* end() const { uint p=nparts-1; cbyte* d=part(p); return d+partSize(count(p),d[0],d[1],last(p)-lo(p))+8; }
+
+  static void encode(const std::vector<uint>& ids, const std::vector<uint>& freqs, /*out*/std::string& out) {
+    uint n=ids.size(), nparts=(n+PEFPart-1)/PEFPart;
+    byte hb[32]; byte* x=hb; *x++=PEFFlag; writeVByte(x,n); writeVByte(x,nparts);
+    std::vector<uint32_t> lasts(nparts), offs(nparts); std::string parts;
+    for (uint p=0;p<nparts;p++) { uint s=p*PEFPart, e=std::min(n,s+PEFPart), c=e-s, lo=(p==0?0:ids[s-1]+1), span=ids[e-1]-lo;
+      uint l=lowBits(c,span+1), fbits=bitsFor(*std::max_element(freqs.begin()+s,freqs.begin()+e)-1);
+      std::vector<byte> low(((uint64_t)c*l+7)/8+8,0), up(((uint64_t)c+(span>>l)+1+7)/8+8,0), f(((uint64_t)c*fbits+7)/8+8,0);
+      for (uint i=0;i<c;i++) { uint v=ids[s+i]-lo; if (l>0) putBits(low,(uint64_t)i*l,v&((1u<<l)-1)); putBits(up,(v>>l)+i,1); if (fbits>0) putBits(f,(uint64_t)i*fbits,freqs[s+i]-1); }
+      lasts[p]=ids[e-1]; offs[p]=parts.size(); parts+=(char)l; parts+=(char)fbits;
+      parts.append((cchar*)low.data(),low.size()-8); parts.append((cchar*)up.data(),up.size()-8); parts.append((cchar*)f.data(),f.size()-8); }
+    out.assign((cchar*)hb,x-hb); out.append((cchar*)lasts.data(),4*lasts.size()); out.append((cchar*)offs.data(),4*offs.size()); out.append(parts); out.append(8,'\0');
+  }
+};
+
+// one partition of a PEFList being read
+struct PEFPartition { uint n, l, fbits, lo; cbyte* low; cbyte* up; cbyte* fr;
+  PEFPartition() { n=l=fbits=lo=0; low=up=fr=NULL; }
+  inline void set(const PEFList& L, uint p) { cbyte* d=L.part(p); l=d[0]; fbits=d[1]; n=L.count(p); lo=L.lo(p);
+    low=d+2; up=low+((uint64_t)n*l+7)/8; fr=up+((uint64_t)n+((L.last(p)-lo)>>l)+1+7)/8; }
+  inline uint64_t upword(uint j) const { return loadWord(up+8*(uint64_t)j); }
+  inline uint lowbits(uint k) const { return getBits(low,(uint64_t)k*l,l); }
+  inline uint freq(uint k) const { return getBits(fr,(uint64_t)k*fbits,fbits)+1; }
+  // upper bit position just after the h-th zero (start of elements with high part >=h), h at most the high part of the last element
+  inline uint select0(uint h) const { if (h==0) return 0;
+    for (uint j=0,zeros=0;;j++) { uint64_t x=~upword(j); uint z=__builtin_popcountll(x);
+      if (zeros+z>=h) { for (uint c=h-zeros-1;c>0;c--) { x&=x-1; } return j*64+__builtin_ctzll(x)+1; } zeros+=z; } }
+};
+
+// (id,freq) of each posting of a list in any encoding, ids local to the list's index
+template <class F> inline static void forPostings(byte* d, byte* dend, F f) {
+  if (isBitmapPL(d)) { BitmapPL b(d); if (b.end()!=dend) {std::cerr<<"ERROR: bitmap postings size"<<std::endl; exit(-1);}
+    uint r=0; for (uint w=0;w<b.nwords;w++) { for (uint64_t x=b.word(w);x!=0;x&=x-1) { f(b.firstid+w*64+__builtin_ctzll(x),b.freq(r++)); } } return; }
+  if (isPEF(d)) { PEFList L(d); if (L.end()!=dend) {std::cerr<<"ERROR: Elias-Fano postings size"<<std::endl; exit(-1);}
+    PEFPartition pp; for (uint p=0;p<L.nparts;p++) { pp.set(L,p);
+      for (uint k=0,ub=0;k<pp.n;k++,ub++) { for (;((pp.upword(ub>>6)>>(ub&63))&1)==0;ub++) {} f(pp.lo+((ub-k)<<pp.l|pp.lowbits(k)),pp.freq(k)); } }
+    return; }
+  uint64_t psize=readVByte(d); if (psize>1) readVByte(d); //lastid
+  for (uint id=0;d<dend;) { id+=readVByte(d); uint freq=readVByte(d); f(id,freq); }
+}
+inline static bool isVBytePL(cbyte* d) { return !isBitmapPL(d) && !isPEF(d); }
@@ -0,0 +1,86 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <cmath>
+
+#include "mmerge.hpp"
+
+/* static index pruning: drop postings with low BM25 impact, keeping the collection statistics so scores match the full index */
+
+class MPrune { protected:
+  MIndexData x; std::vector<float> impact; std::vector<bool> keep; //per posting
+public:
+  int topk; float epsilon, fraction; //term-centric: keep impact>=epsilon*(topk-th best of the list), document-centric: keep the best fraction of each document's terms
+  MPrune() { topk=10; epsilon=-1.0f; fraction=-1.0f; }
+
+  void input(cchar* fn) { x.read(fn); }
+
+  // BM25 impact of each posting (idf x tf part as msearch doQuery, query weight 1)
+  void impacts() { float avgDocSize=(double)x.totaltokens/x.doccount(); impact.resize(x.ids.size());
+    for (int t=0;t<x.tokens.size();t++) { double idf=bm25idf(x.doccount(),x.df(t));
+      for (uint64_t i=x.start[t];i<x.start[t+1];i++) { impact[i]=(float)(idf*bm25tf(x.freqs[i],x.docsizes[x.ids[i]],avgDocSize)); } }
+  }
+
+  // top topk postings of every list stay (epsilon<=1), so single term queries to depth topk are unchanged
+  void termCentric() { std::vector<float> v;
+    for (int t=0;t<x.tokens.size();t++) { uint64_t s=x.start[t], e=x.start[t+1]; float z=0.0f;
+      if (e-s>topk) { v.assign(impact.begin()+s,impact.begin()+e); std::nth_element(v.begin(),v.begin()+topk-1,v.end(),std::greater<float>()); z=v[topk-1]*epsilon; }
+      for (uint64_t i=s;i<e;i++) { keep[i]=(impact[i]>=z); } }
+  }
+
+  // best ceil(fraction x distinct terms) postings of every document, ties to the earlier list
+  void docCentric() { uint n=x.doccount(); std::vector<uint64_t> fstart(n+1,0), at;
+    for (uint64_t i=0;i<x.ids.size();i++) { fstart[x.ids[i]+1]++; }
+    for (uint d=0;d<n;d++) { fstart[d+1]+=fstart[d]; }
+    std::vector<uint64_t> fwd(x.ids.size()); at.assign(fstart.begin(),fstart.end()-1);
+    for (uint64_t i=0;i<x.ids.size();i++) { fwd[at[x.ids[i]]++]=i; } // postings of doc d in list order
+    for (uint d=0;d<n;d++) { uint64_t* b=fwd.data()+fstart[d]; uint64_t* e=fwd.data()+fstart[d+1]; uint c=(uint)ceil(fraction*(e-b));
+      std::partial_sort(b,b+std::min<uint64_t>(c,e-b),e,[&](uint64_t i, uint64_t j){ return impact[i]>impact[j] || (impact[i]==impact[j] && i<j); });
+      for (uint64_t* p=b;p<b+c && p<e;p++) { keep[*p]=true; } }
+  }
+
+  void prune() { impacts(); keep.assign(x.ids.size(),false);
+    if (epsilon>=0.0f) termCentric(); else docCentric();
+    uint64_t kept=0; int lists=0; for (int t=0;t<x.tokens.size();t++) { uint64_t k=0; for (uint64_t i=x.start[t];i<x.start[t+1];i++) { k+=keep[i]; } kept+=k; lists+=(k>0); }
+    std::cerr<<"Kept "<<kept<<" of "<<x.ids.size()<<" postings ("<<100.0*kept/std::max((size_t)1,x.ids.size())<<"%), "<<lists<<" of "<<x.tokens.size()<<" postings lists"<<std::endl;
+  }
+
+  // pruned VByte mindex, .meta with stats of the kept postings (as mencode -s) and unpruned document frequencies
+  void output(cchar* outfn) { MMeta meta; float avgDocSize=(double)x.totaltokens/x.doccount();
+    for (int t=0;t<x.tokens.size();t++) { TermStat st; st.maxtf=0; st.maxbm25tf=0.0f; bool bAny=false;
+      for (uint64_t i=x.start[t];i<x.start[t+1];i++) { if (!keep[i]) continue; bAny=true;
+        st.maxtf=std::max(st.maxtf,x.freqs[i]); st.maxbm25tf=std::max(st.maxbm25tf,bm25tf(x.freqs[i],x.docsizes[x.ids[i]],avgDocSize)); }
+      if (!bAny) continue;
+      st.maxbm25tf=nextafterf(st.maxbm25tf,3.0f); meta.stats.push_back(st); meta.dfs.push_back(x.df(t)); }
+    x.write(outfn,std::vector<uint>(),keep,meta);
+  }
+};
+
+static void usage() {
+  std::cerr<<"Usage: ./mprune.exe [-k#] -e#.# -o out.mindex data.mindex"<<std::endl;
+  std::cerr<<"       ./mprune.exe -d#.# -o out.mindex data.mindex"<<std::endl;
+  std::cerr<<" where -e term-centric: keep postings with BM25 impact at least #.# [0-1] times the -k (default 10) best of their list,"<<std::endl;
+  std::cerr<<"   -d document-centric: keep the #.# (0-1] fraction of each document's terms with the highest impact,"<<std::endl;
+  std::cerr<<"   output is a VByte mindex whose .meta keeps the unpruned document frequencies (do not mencode or mmerge it, which drops them)"<<std::endl;
+  exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+  MPrune p; int s=1; cchar* outfile=NULL;
+  for (;;) {
+    if (s<argc && strstr(argv[s],"-k")==argv[s]) { p.topk=std::stoi(argv[s]+2); if (p.topk<1) usage(); s++; }
+    else if (s<argc && strstr(argv[s],"-e")==argv[s]) { p.epsilon=std::stof(argv[s]+2); if (p.epsilon<0.0f || p.epsilon>1.0f) usage(); s++; }
+    else if (s<argc && strstr(argv[s],"-d")==argv[s]) { p.fraction=std::stof(argv[s]+2); if (p.fraction<=0.0f || p.fraction>1.0f) usage(); s++; }
+    else if (s<argc && strcmp(argv[s],"-o")==0) { if (s+1>=argc) usage(); outfile=argv[s+1]; s+=2; }
+    else if (argc-s!=1 || outfile==NULL || (p.epsilon<0.0f)==(p.fraction<0.0f)) usage();
+    else break;
+  }
+  std::cerr<<"Input "<<argv[s]<<std::endl;
+  p.input(argv[s]);
+  p.prune();
+  p.output(outfile);
+  std::cerr<<"Done output."<<std::endl;
+  return 0;
+}
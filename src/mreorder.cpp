@@ -0,0 +1,116 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <cmath>
+
+#include "mmerge.hpp"
+
+/* reorder docids of a mindex by recursive graph bisection (BP), so documents sharing terms get close docids (smaller d-gaps) */
+
+class MReorder { protected:
+  MIndexData x; std::vector<std::string>& tokens; std::vector<uint64_t>& start; std::vector<uint>& ids; //postings of token t in [start[t],start[t+1])
+  std::vector<uint64_t> fstart; std::vector<uint> fterms; //forward index of terms used by bisection, doc d in [fstart[d],fstart[d+1])
+  std::vector<uint> order; //new docid -> old docid
+
+  struct Scratch { std::vector<int> d1, d2; std::vector<float> gl, gr; std::vector<uint64_t> stamp; uint64_t now;
+    Scratch(uint n) : d1(n,0), d2(n,0), gl(n), gr(n), stamp(n,0) { now=0; } };
+  struct Gain { float g; uint doc; inline bool operator<(const Gain& o) const { return g>o.g || (g==o.g && doc<o.doc); } }; //best first
+
+  // approximate bits for a term in d of n documents (log gap cost)
+  static inline double cost(int d, int n) { return (d<=0?0.0:d*log2((double)n/(d+1))); }
+
+  inline void degrees(uint* b, uint* e, std::vector<int>& deg, int v) { for (uint* x=b;x<e;x++) { for (uint64_t i=fstart[*x];i<fstart[*x+1];i++) deg[fterms[i]]+=v; } }
+
+  // gains of moving each doc of [b,e) to the other side (bLeft: from the left), per term cost changes computed once per iteration
+  void gains(uint* b, uint* e, bool bLeft, int n1, int n2, Scratch& s, std::vector<Gain>& g) { g.clear();
+    for (uint* x=b;x<e;x++) { double sum=0.0;
+      for (uint64_t i=fstart[*x];i<fstart[*x+1];i++) { uint t=fterms[i];
+        if (s.stamp[t]!=s.now) { s.stamp[t]=s.now; int a=s.d1[t], c=s.d2[t]; double before=cost(a,n1)+cost(c,n2);
+          s.gl[t]=before-cost(a-1,n1)-cost(c+1,n2); s.gr[t]=before-cost(a+1,n1)-cost(c-1,n2); }
+        sum+=(bLeft?s.gl[t]:s.gr[t]); }
+      g.push_back(Gain{(float)sum,*x}); }
+    std::sort(g.begin(),g.end());
+  }
+
+  void bisect(uint* b, uint* e, int depth, Scratch& s) {
+    int n=e-b; if (n<=leaf || depth>=maxDepth) return;
+    int n1=n/2, n2=n-n1; uint* m=b+n1;
+    degrees(b,m,s.d1,1); degrees(m,e,s.d2,1);
+    std::vector<Gain> L, R;
+    for (int it=0;it<iterations;it++) {
+      s.now++; gains(b,m,true,n1,n2,s,L); gains(m,e,false,n1,n2,s,R);
+      int swaps=0; for (;swaps<L.size() && swaps<R.size() && L[swaps].g+R[swaps].g>0.0f;swaps++) {}
+      if (swaps==0) break;
+      for (int i=0;i<swaps;i++) { uint l=L[i].doc, r=R[i].doc; // swap sides
+        for (uint64_t j=fstart[l];j<fstart[l+1];j++) { s.d1[fterms[j]]--; s.d2[fterms[j]]++; }
+        for (uint64_t j=fstart[r];j<fstart[r+1];j++) { s.d2[fterms[j]]--; s.d1[fterms[j]]++; }
+        L[i].doc=r; R[i].doc=l; }
+      for (int i=0;i<n1;i++) { b[i]=L[i].doc; } for (int i=0;i<n2;i++) { m[i]=R[i].doc; }
+    }
+    degrees(b,m,s.d1,-1); degrees(m,e,s.d2,-1); //scratch back to zero
+    if ((1<<depth)<threads) { std::thread t([&,depth]() { Scratch s2(tokens.size()); bisect(b,m,depth+1,s2); }); bisect(m,e,depth+1,s); t.join(); }
+    else { bisect(b,m,depth+1,s); bisect(m,e,depth+1,s); }
+  }
+
+  // docid gap cost of all lists under docid map nid (VByte bytes, log2 bits)
+  void gapBits(const std::vector<uint>& nid, double& vbits, double& lbits) { vbits=lbits=0.0; std::vector<uint> v;
+    for (int t=0;t<tokens.size();t++) { v.clear(); for (uint64_t i=start[t];i<start[t+1];i++) { v.push_back(nid[ids[i]]); }
+      std::sort(v.begin(),v.end()); for (int i=0;i<v.size();i++) { uint g=v[i]-(i==0?0:v[i-1]); vbits+=8*vbytesize(g); lbits+=log2((double)g+1.0); } }
+    vbits/=ids.size(); lbits/=ids.size();
+  }
+
+public:
+  int threads, iterations, leaf, maxDepth; uint minDF;
+  MReorder() : tokens(x.tokens), start(x.start), ids(x.ids) { threads=1; iterations=20; leaf=16; maxDepth=64; minDF=2; }
+
+  // any list encoding, deleted documents (.del) dropped as in mmerge
+  void input(cchar* fn) { x.read(fn); }
+
+  void reorder() { uint n=x.doccount();
+    // forward index of terms in at least minDF documents
+    std::vector<uint64_t> cnt(n+1,0);
+    for (int t=0;t<tokens.size();t++) { if (start[t+1]-start[t]<minDF) continue; for (uint64_t i=start[t];i<start[t+1];i++) cnt[ids[i]+1]++; }
+    fstart.assign(n+1,0); for (uint d=0;d<n;d++) { fstart[d+1]=fstart[d]+cnt[d+1]; }
+    fterms.resize(fstart[n]); std::vector<uint64_t> at(fstart.begin(),fstart.end()-1);
+    for (int t=0;t<tokens.size();t++) { if (start[t+1]-start[t]<minDF) continue; for (uint64_t i=start[t];i<start[t+1];i++) fterms[at[ids[i]]++]=t; }
+    order.resize(n); for (uint d=0;d<n;d++) { order[d]=d; }
+    std::vector<uint> nid(n); for (uint d=0;d<n;d++) { nid[d]=d; }
+    double vb, lb; gapBits(nid,vb,lb); std::cerr<<"Before: "<<vb<<" VByte bits per docid gap, "<<lb<<" log2 bits"<<std::endl;
+    std::chrono::high_resolution_clock::time_point s=std::chrono::high_resolution_clock::now();
+    if (n>0) { Scratch sc(tokens.size()); bisect(order.data(),order.data()+n,0,sc); }
+    std::chrono::high_resolution_clock::time_point e=std::chrono::high_resolution_clock::now();
+    for (uint d=0;d<n;d++) { nid[order[d]]=d; }
+    gapBits(nid,vb,lb); std::cerr<<"After: "<<vb<<" VByte bits per docid gap, "<<lb<<" log2 bits ("<<(double)std::chrono::duration_cast<std::chrono::milliseconds>(e-s).count()/1000<<"s using "<<threads<<" threads)"<<std::endl;
+  }
+
+  // reordered VByte mindex and its .meta
+  void output(cchar* outfn) { uint n=x.doccount(); std::vector<uint> nid(n); for (uint d=0;d<n;d++) { nid[order[d]]=d; }
+    MMeta meta; x.write(outfn,nid,std::vector<bool>(),meta); }
+};
+
+static void usage() {
+  std::cerr<<"Usage: ./mreorder.exe [-t#] [-i#] [-l#] -o out.mindex data.mindex"<<std::endl;
+  std::cerr<<" where -t threads for the bisection, -i iterations per level (default 20), -l leaf size where bisection stops (default 16),"<<std::endl;
+  std::cerr<<"   output is a VByte mindex with its .meta (mmerge -b/-e to re-encode, mencode -s for stats)"<<std::endl;
+  exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+  MReorder r; int s=1; cchar* outfile=NULL;
+  for (;;) {
+    if (s<argc && strstr(argv[s],"-t")==argv[s]) { r.threads=std::stoi(argv[s]+2); if (r.threads<1) usage(); s++; }
+    else if (s<argc && strstr(argv[s],"-i")==argv[s]) { r.iterations=std::stoi(argv[s]+2); if (r.iterations<1) usage(); s++; }
+    else if (s<argc && strstr(argv[s],"-l")==argv[s]) { r.leaf=std::stoi(argv[s]+2); if (r.leaf<2) usage(); s++; }
+    else if (s<argc && strcmp(argv[s],"-o")==0) { if (s+1>=argc) usage(); outfile=argv[s+1]; s+=2; }
+    else if (argc-s!=1 || outfile==NULL) usage();
+    else break;
+  }
+  std::cerr<<"Input "<<argv[s]<<std::endl;
+  r.input(argv[s]);
+  r.reorder();
+  r.output(outfile);
+  std::cerr<<"Done output."<<std::endl;
+  return 0;
+}
@@ -10,14 +10,22 @@
 #include <vector>
 #include <cmath> // for log()
 #include <algorithm>
+#include <unordered_map>
+#include <list>
 #include <chrono>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <unistd.h> // for close
 #include <sys/stat.h>
 #include <sys/fcntl.h> // for O_RDONLY
 #include <sys/mman.h> // for mmap
 
-#include "mtokenizer.hpp"
-#include "mdictionary.hpp"
+#include "mtokenize.hpp" // includes mtokenizer.hpp
+#include "mmeta.hpp"
+#include "mdocstore.hpp"
+#include "msegment.hpp"
 
 /* read in mindex file, run queries from stdin, output DOCNO results to stdout */
 
@@ -30,38 +38,135 @@ class TopkHeap : public std::vector<Scored> { public:
   //void dump() { for (int i=0;i<size();i++) {std::cerr<<(*this)[i].docid<<":"<<(*this)[i].score<<" ";} std::cerr<<std::endl; }
 };
 
-class PLIter { byte* d; byte* dend; public: int32_t id; int32_t freq; int plsize; float w;
+class PLIter { enum { VBYTE, PAIRS, BITMAP, PEF }; int mode; int32_t bbase; //bbase: segment base docid for bitmap and Elias-Fano
+  byte* d; byte* dend; const int32_t* p; const int32_t* pend; //VByte bytes, decoded pairs
+  BitmapPL bm; uint wi, rk; uint64_t cur; //bitmap: word, rank, remaining bits
+  PEFList ef; PEFPartition pp; uint pi, ub; int k; //Elias-Fano: partition, next upper bit, index in partition
+public: int32_t id; int32_t freq; int plsize, df; float w; float maxs; //maxs bounds BM25 tf component, df over all segments
   PLIter() {std::cerr<<"ERROR: PLIter()"<<std::endl; exit(-1);}
-  PLIter(byte* data, int blen, float weight) { d=data; dend=d+blen; id=freq=0; plsize=readVByte(d); w=weight; int lastid=(plsize>1?readVByte(d):-1); next(); }
-  inline bool next() { if (d>=dend) return false; id+=readVByte(d); freq=readVByte(d); return true; }
+  PLIter(byte* data, int blen, float weight, int base=0) { d=data; dend=d+blen; p=pend=NULL; id=base; freq=0; w=weight; maxs=Scorer<BM25>::maxtf();
+    if (isBitmapPL(data)) { mode=BITMAP; bm=BitmapPL(data); plsize=df=bm.psize; wi=rk=0; cur=bm.word(0); bbase=base+bm.firstid; next(); return; }
+    if (isPEF(data)) { mode=PEF; ef=PEFList(data); plsize=df=ef.psize; pi=0; pp.set(ef,0); k=-1; ub=0; bbase=base; next(); return; }
+    mode=VBYTE; plsize=df=readVByte(d); int lastid=(plsize>1?readVByte(d):-1); next(); }
+  inline bool next() {
+    switch (mode) {
+    case VBYTE: if (d>=dend) return false; id+=readVByte(d); freq=readVByte(d); return true;
+    case PAIRS: if (p>=pend) return false; id=p[0]; freq=p[1]; p+=2; return true;
+    case BITMAP: while (cur==0) { if (++wi>=bm.nwords) { wi=bm.nwords; return false; } cur=bm.word(wi); }
+      id=bbase+wi*64+__builtin_ctzll(cur); cur&=cur-1; freq=bm.freq(rk++); return true;
+    default: if (++k>=(int)pp.n) { if (++pi>=ef.nparts) { pi=ef.nparts; k=pp.n; return false; } pp.set(ef,pi); k=0; ub=0; }
+      { uint64_t x=pp.upword(ub>>6)>>(ub&63); while (x==0) { ub=(ub|63)+1; x=pp.upword(ub>>6); } ub+=__builtin_ctzll(x); }
+      id=bbase+pp.lo+((ub-k)<<pp.l|pp.lowbits(k)); freq=pp.freq(k); ub++; return true;
+    } }
+  // (id, freq) pairs of the whole list from here, then iterate over such pairs instead of the bytes
+  inline void decode(/*out*/std::vector<int32_t>& v) const { PLIter t=*this; v.reserve(2*plsize); do { v.push_back(t.id); v.push_back(t.freq); } while (t.next()); }
+  inline void use(const std::vector<int32_t>& v) { mode=PAIRS; p=v.data()+2; pend=v.data()+v.size(); id=v[0]; freq=v[1]; }
+  // first id>=target, false at end (pairs: gallop then branch-free binary search, bitmap: rank samples and popcount,
+  // Elias-Fano: gallop over partition ends then select in the high bits, bytes: next)
+  inline bool skipTo(int32_t target) { if (id>=target) return true;
+    if (mode==PEF) { uint t=target-bbase;
+      if (t>ef.last(pi)) { uint q=ef.find(pi+1,t); if (q>=ef.nparts) { pi=ef.nparts; k=pp.n; return false; } pi=q; pp.set(ef,pi); k=-1; ub=0; }
+      uint h=(t-pp.lo)>>pp.l; if (k<0 || h>ub-1-k) { uint s=pp.select0(h); k=s-h-1; ub=s; } // jump to the first element with high part h
+      while (next()) { if (id>=target) return true; } return false; }
+    if (mode==BITMAP) { uint off=target-bbase, tw=off>>6; uint64_t m=~0ull<<(off&63);
+      if (tw>=bm.nwords) { wi=bm.nwords; cur=0; return false; }
+      if (tw>wi) { uint64_t x=bm.word(tw); rk=bm.rank(tw)+__builtin_popcountll(x&~m); cur=x&m; wi=tw; } else { rk+=__builtin_popcountll(cur&~m); cur&=m; }
+      return next(); }
+    if (mode==VBYTE) { while (next()) { if (id>=target) return true; } return false; }
+    size_t n=(pend-p)/2; if (n==0 || p[2*(n-1)]<target) { p=pend; return false; }
+    size_t lo=0, step=1; if (p[0]<target) { for (;lo+step<n-1 && p[2*(lo+step)]<target;step*=2) { lo+=step; } lo++; } // answer in [lo,min(lo+step,n-1)]
+    const int32_t* b=p+2*lo; size_t len=std::min(lo+step,n-1)-lo+1;
+    while (len>1) { size_t half=len/2; b=(b[2*half]<target?b+2*half:b); len-=half; }
+    b+=(b[0]<target?2:0); id=b[0]; freq=b[1]; p=b+2; return true; }
 };
 inline bool PLICompID(const PLIter* i, const PLIter* j) { return i->id < j->id; }
-class PLIV : public std::vector<PLIter> {};
+class PLIV : public std::vector<PLIter> { public: std::vector<std::shared_ptr<std::vector<int32_t>>> pins; }; //pins: cached pairs used by the iterators
 
-class MSearch { public: bool bMath; float alpha; protected: int k;
-  DocnamesTwoLayer* docs; uint64_t totaltokens; //docs(docname->docsize)
-  int pffd; char* mmpf; int64_t pfsize; //memory map of postfile
-  DictionaryTwoLayer* dict; //dict(token->location) points into postfile
+// == PostingsCache ======================================================
+// decoded (global docid, freq) pairs of frequently used long postings lists of one index snapshot,
+// admitted on the second use (or from a warm-up term list), least recently used evicted above the memory cap
+
+class PostingsCache { public: typedef std::shared_ptr<std::vector<int32_t>> Pairs;
+protected:
+  struct Entry { Pairs v; std::list<uint64_t>::iterator lru; };
+  std::unordered_map<uint64_t,Entry> m; std::list<uint64_t> lru; std::unordered_map<uint64_t,int> seen; //lru front is most recent
+  std::weak_ptr<MSegments> owner; uint64_t bytes, cap, hits, misses, evictions;
+  static inline uint64_t key(int seg, uint64_t loc) { return (uint64_t)seg<<48|loc; }
+  static inline uint64_t size(const Pairs& v) { return v->capacity()*sizeof(int32_t)+64; }
+public:
+  static const int MinPostings=128; //shorter lists are cheap to decode
+  PostingsCache() { bytes=cap=hits=misses=evictions=0; }
+  inline bool enabled() const { return cap>0; }
+  void setCap(uint64_t c) { cap=c; }
+  // entries belong to one snapshot, cleared when a query sees another one (hot swap)
+  void attach(const std::shared_ptr<MSegments>& ix) { if (owner.lock()==ix) return; m.clear(); lru.clear(); seen.clear(); bytes=0; owner=ix; }
+  inline Pairs get(int seg, uint64_t loc) { std::unordered_map<uint64_t,Entry>::iterator f=m.find(key(seg,loc));
+    if (f==m.end()) { misses++; return Pairs(); }
+    hits++; lru.splice(lru.begin(),lru,f->second.lru); return f->second.v; }
+  // adaptive admission: true once a list is asked for again (or bForce), then put its pairs
+  inline bool admit(int seg, uint64_t loc, bool bForce=false) { if (bForce) return true;
+    if (seen.size()>=(1<<16)) seen.clear(); return ++seen[key(seg,loc)]>=2; }
+  inline void put(int seg, uint64_t loc, const Pairs& v) { uint64_t k=key(seg,loc), s=size(v); if (s>cap || m.count(k)>0) return;
+    for (;bytes+s>cap && lru.size()>0;evictions++) { std::unordered_map<uint64_t,Entry>::iterator e=m.find(lru.back()); bytes-=size(e->second.v); m.erase(e); lru.pop_back(); } // in-use pairs stay pinned by queries
+    lru.push_front(k); m[k]=Entry{v,lru.begin()}; bytes+=s; seen.erase(k); }
+  void stats() { std::cerr<<"Postings cache: "<<hits<<" hits, "<<misses<<" misses, "<<evictions<<" evictions, "<<m.size()<<" lists, "<<bytes<<" of "<<cap<<" bytes"<<std::endl; }
+};
+
+struct QTerm { std::string token; float weight; }; // distinct query token with its normalized weight
+typedef std::unordered_map<std::string,std::vector<std::vector<int32_t>>> SharedPLs; // token -> decoded postings per segment, for a batch
+
+class MSearch { public: bool bMath, bNormalize; float alpha; bool bFuseApprox, bPlus, bGeneric; MTokenize normalizer; protected: int k, taatWidth; //bFuseApprox: math sub-index fused without rescoring, bPlus: BM25+, bGeneric: WAND loop for all queries, taatWidth: queries of at least # lists term-at-a-time (0 never)
+  static const int TaatBlock=1<<16; //accumulator floats per docid range (256KB, fits L2)
+  int deadlineMs; int64_t postingsBudget; float theta; int64_t planBudget; //planBudget: postings of the kept terms (-Q) //anytime evaluation: stop at a time or scored postings budget, threshold factor>1 approximates
+  std::shared_ptr<MSegments> current; //queries hold the snapshot they started with (RCU style), the last holder frees it
+  std::string fn; int reloadSecs; std::thread watcher; std::mutex wm; std::condition_variable wcv; bool bStop; //hot swap
+  std::mutex hotm; std::vector<std::string> hot; int hotnext; //recent query tokens, pre-warmed before a swap
   MTokenizer tokenizer;
+  OutBuf normalized; std::string normerr; std::vector<cchar*> normv; // reused by in-process normalization
+  DocStore* store; //optional document text for results
+  PostingsCache cache; std::vector<std::string> warm; //decoded hot lists, optional warm-up tokens
 
-  // TODO: assumes token sizes are less than 2^14
-  inline std::string getlinepf(char*& x /*in/out*/) { char* e=x; for (;e<x+(1<<14);e++) { if (*e=='\n') break; } std::string r=std::string(x,e-x); if (*e=='\n') x=e; return r; }
-
-  inline PLIter loadPL(uint64_t loc, float weight, /*out*/std::string& t) {
-    if (loc>=pfsize) {std::cerr<<"ERROR: bad location "<<loc<<" max is "<<pfsize<<std::endl; exit(-1);}
-    char* x=mmpf+loc; std::istringstream in(getlinepf(x));
-    if (*x!='\n') {std::cerr<<"ERROR: bad token location data "<<std::string(x,1<<14)<<std::endl; exit(-1);}
-    // TODO: make index handle tokens with spaces
-    x++; in>>t; int blen; in>>blen;
-    { std::string line; getline(in,line); if (line.compare("")!=0) {std::cerr<<"ERROR: index extra postings info "<<t<<" "<<line<<std::endl; exit(-1);} }
-    volatile char touch=0; for (char* p=x; p<x+blen; p+=1<<12) { touch+=*p; } //force load into memory
-    { if (*(x+blen)!='\n') {std::cerr<<"ERROR: index extra postings "<<t<<std::endl; exit(-1);} }
-    PLIter pli((byte*)x,blen,weight);
-    if (pli.plsize>docs->size()) {std::cerr<<"ERROR: plsize "<<pli.plsize<<" > docs.size "<<docs->size()<<std::endl; exit(-1);}
+  inline PLIter loadPL(MSegment& sg, uint64_t loc, float weight, /*out*/std::string& t) {
+    int blen; byte* x=sg.postings(loc,t,blen);
+    PLIter pli(x,blen,weight,sg.base);
+    if (pli.plsize>sg.docs->size()) {std::cerr<<"ERROR: plsize "<<pli.plsize<<" > docs.size "<<sg.docs->size()<<std::endl; exit(-1);}
     return pli;
   }
 
-  inline void getIterators(/*in*/MTokenizer::TokenList& tokens, /*out*/PLIV& listIters) {
+  inline void remember(cchar* token) { std::lock_guard<std::mutex> l(hotm);
+    if (hot.size()<(1<<12)) hot.push_back(token); else { hot[hotnext]=token; hotnext=(hotnext+1)%hot.size(); } }
+
+  // touch postings of recent query tokens so the first queries after a swap are warm
+  void prewarm(MSegments& ix) { std::vector<std::string> h; { std::lock_guard<std::mutex> l(hotm); h=hot; }
+    for (int i=0;i<h.size();i++) { for (int j=0;j<ix.segs.size();j++) { MSegment& sg=*ix.segs[j];
+      uint64_t loc=sg.dict->getV(h[i].c_str()); if (loc==IntDeltaV::UNKNOWN) continue; std::string t; int blen; sg.postings(loc,t,blen); } }
+    std::cerr<<"Pre-warmed "<<h.size()<<" tokens"<<std::endl;
+  }
+
+  // snapshot deleter when hot swapping: the last holder (often a query) hands the unmap to a detached thread
+  static void reclaim(MSegments* x) { std::thread([x]() { delete x; }).detach(); }
+
+  // poll index files, load a changed index in the background and swap it in, the old one is freed by its last holder,
+  // an index failing to load (e.g. a segment removed after validation) keeps the current one and is retried at the next poll
+  void watch() {
+    std::string sig=MSegments::signature(fn.c_str());
+    std::unique_lock<std::mutex> l(wm);
+    while (!wcv.wait_for(l,std::chrono::seconds(reloadSecs),[&]{ return bStop; })) {
+      std::string t=MSegments::signature(fn.c_str()); if (t.compare(sig)==0) continue;
+      if (!MSegments::valid(fn.c_str())) continue; // e.g. between the renames of a rebuild, retry later
+      l.unlock();
+      std::chrono::high_resolution_clock::time_point s=std::chrono::high_resolution_clock::now();
+      MSegments* x=MSegments::tryLoad(fn.c_str(),bMath);
+      if (x==NULL) { std::cerr<<"WARNING: keeping index, could not load "<<fn<<std::endl; l.lock(); continue; }
+      std::shared_ptr<MSegments> n(x,reclaim); prewarm(*n); if (n->math!=NULL) prewarm(*n->math);
+      std::atomic_exchange(&current,n); sig=t; // old snapshot released here or by the last query holding it
+      std::chrono::high_resolution_clock::time_point e=std::chrono::high_resolution_clock::now();
+      std::cerr<<"Swapped index "<<fn<<" loaded in "<<(double)std::chrono::duration_cast<std::chrono::microseconds>(e-s).count()/1000<<"ms"<<std::endl;
+      l.lock();
+    }
+  }
+
+  inline void getTerms(/*in*/MTokenizer::TokenList& tokens, /*out*/std::vector<QTerm>& terms) {
     tokens.sort();
     int totalWeight=0; for (int i=0;i<tokens.size();i++) { totalWeight+=tokens.weight(i); }
     float wnorm=(double)tokens.size()/totalWeight;
@@ -69,151 +174,376 @@ class MSearch { public: bool bMath; float alpha; protected: int k;
     for (int i=0;i<tokens.size();) {
       cchar* token=tokens[i]; int w=tokens.weight(i); i++;
       while (i<tokens.size() && strcmp(token,tokens[i])==0) { w+=tokens.weight(i); ++i; }
-      float weight=w*wnorm/(w*wnorm+10.0f); if (bMath) { weight*=(token[0]=='#'?alpha:1.0f-alpha); }
-      uint64_t loc=dict->getV(token);
-      if (loc==IntDeltaV::UNKNOWN) continue; //not-in-data
+      float weight=w*wnorm/(w*wnorm+10.0f); //alpha for math by the scoring policy
+      terms.push_back(QTerm{token,weight});
+    }
+  }
+
+  // lists of a term over all segments, planned (-Q) before decoding, shared lists are decoded by the first query of a batch using them,
+  // sbase: cache and shared slot of the first segment (after the text segments for a math sub-index)
+  struct PLSrc { int term, seg; uint64_t loc; };
+  inline void getIterators(MSegments& ix, /*in*/std::vector<QTerm>& terms, /*out*/PLIV& listIters, SharedPLs* shared=NULL, int sbase=0) {
+    std::vector<PLSrc> src; float avgDocSize=(double)ix.totaltokens/ix.doccount;
+    for (int i=0;i<terms.size();i++) {
+      cchar* token=terms[i].token.c_str(); float weight=terms[i].weight;
+      if (reloadSecs>0) remember(token);
+      int first=listIters.size(), df=0;
+      for (int j=0;j<ix.segs.size();j++) { MSegment& sg=*ix.segs[j];
+        IntDeltaV lv=sg.dict->getV(token); uint64_t loc=lv;
+        if (loc==IntDeltaV::UNKNOWN) continue; //not-in-data
 
-      std::string t; PLIter pli=loadPL(loc,weight,t);
-      if (strcmp(token,t.c_str())!=0) {std::cerr<<"ERROR: pointing to wrong token "<<token<<" -> "<<t<<std::endl; exit(-1);}
-      listIters.push_back(pli);
+        std::string t; PLIter pli=loadPL(sg,loc,weight,t);
+        if (sg.stats.size()>0) { TermStat& st=sg.stats[lv.id]; // segment bound holds if global docs are no longer on average (a longer average lowers the length norm, raising tf scores)
+          pli.maxs=((double)sg.totaltokens/sg.docs->size()>=avgDocSize?st.maxbm25tf:bm25tf(st.maxtf,0,avgDocSize)); }
+        if (strcmp(token,t.c_str())!=0) {std::cerr<<"ERROR: pointing to wrong token "<<token<<" -> "<<t<<std::endl; exit(-1);}
+        listIters.push_back(pli); src.push_back(PLSrc{i,j,loc}); df+=(sg.dfs.size()>0?sg.dfs[lv.id]:pli.plsize); //pruned lists keep idf
+      }
+      for (int j=first;j<listIters.size();j++) { listIters[j].df=df; } //global BM25 document frequency
+    }
+    if (planBudget>0) plan(ix, terms, listIters, src);
+    if (shared==NULL && !cache.enabled()) return;
+    for (int k=0;k<listIters.size();k++) { PLIter& pli=listIters[k]; int j=sbase+src[k].seg; uint64_t loc=src[k].loc;
+      if (cache.enabled() && pli.plsize>=PostingsCache::MinPostings) { PostingsCache::Pairs v=cache.get(j,loc);
+        if (v==NULL && cache.admit(j,loc)) { v=std::make_shared<std::vector<int32_t>>(); pli.decode(*v); cache.put(j,loc,v); }
+        if (v!=NULL) { pli.use(*v); listIters.pins.push_back(v); continue; } }
+      SharedPLs::iterator sh; if (shared!=NULL && (sh=shared->find(terms[src[k].term].token))!=shared->end()) {
+        std::vector<int32_t>& v=sh->second[j]; if (v.size()==0) pli.decode(v); pli.use(v); }
     }
   }
 
-  void doQuery(/*in*/const std::string& prefix, /*in*/PLIV& listIters, std::ostream& out, int doccount, float avgDocSize) {
-    // precompute IDF for BM25
+  // keep terms by score bound (idf x weight x max tf part) per postings (cost) while within the postings budget,
+  // dropping the rest before any list is decoded (the best term is always kept)
+  void plan(MSegments& ix, /*in*/std::vector<QTerm>& terms, /*in/out*/PLIV& listIters, std::vector<PLSrc>& src) {
+    int n=terms.size(); std::vector<int64_t> cost(n,0); std::vector<float> benefit(n,0.0f); std::vector<int> order;
+    for (int k=0;k<listIters.size();k++) { PLIter& pli=listIters[k]; int t=src[k].term; if (cost[t]==0) order.push_back(t);
+      cost[t]+=pli.plsize; benefit[t]=std::max(benefit[t],(float)(pli.w*bm25idf(ix.doccount,pli.df)*pli.maxs)); }
+    std::stable_sort(order.begin(),order.end(),[&](int a, int b){ return (double)benefit[a]/cost[a]>(double)benefit[b]/cost[b]; });
+    std::vector<bool> keep(n,false); int64_t used=0, total=0; double kept=0.0, all=0.0; int nkept=0;
+    for (int i=0;i<order.size();i++) { int t=order[i]; total+=cost[t]; all+=benefit[t];
+      if (i==0 || used+cost[t]<=planBudget) { keep[t]=true; used+=cost[t]; kept+=benefit[t]; nkept++; } }
+    int o=0; for (int k=0;k<listIters.size();k++) { if (keep[src[k].term]) { listIters[o]=listIters[k]; src[o]=src[k]; o++; } }
+    listIters.erase(listIters.begin()+o,listIters.end()); src.resize(o);
+    if (nkept<order.size()) std::cerr<<"plan: kept "<<nkept<<" of "<<order.size()<<" terms, "<<used<<" of "<<total<<" postings, pruned "<<(all>0.0?100.0*(all-kept)/all:0.0)<<"% of score bound"<<std::endl;
+  }
+
+  // precompute IDF for BM25
+  inline void weigh(/*in/out*/PLIV& listIters, int doccount) {
     for (int i=0;i<listIters.size();i++) { PLIter& pli=listIters[i];
-      pli.w*=log(1.0f+((float)doccount-pli.plsize+0.5f)/(pli.plsize+0.5f));
+      pli.w*=bm25idf(doccount,pli.df);
       //std::cerr<<"idf*weight="<<pli.w<<std::endl;
     }
-    //TODO: save non-weighted token count in mindex & meta
-    float fnorm=1.0f; //(double)1238766252/totaltokens;
-    //std::cerr<<"fnorm="<<fnorm<<std::endl;
+  }
+
+  // top kk of weighted lists, document length norms and tombstones from ix, floor: known lower bound of the kk-th score,
+  // one and two term queries use their own loops unless bGeneric
+  template <class P> TopkHeap topk(MSegments& ix, /*in*/PLIV& listIters, int kk, std::chrono::steady_clock::time_point deadline, float floor=0.0f) {
+    static_assert(P::k1==BM25::k1 && P::b==BM25::b, "norms are for the BM25 k1 and b");
+    if (!bGeneric && taatWidth>0 && listIters.size()>=taatWidth) return taat<P>(ix,listIters,kk,deadline,floor);
+    if (!bGeneric && listIters.size()==1) return topk1<P>(ix,listIters[0],kk,deadline,floor);
+    if (!bGeneric && listIters.size()==2) return topk2<P>(ix,listIters[0],listIters[1],kk,deadline,floor);
     // intersect iterators w scoring
-    TopkHeap h(k); float T=0.0f;
+    TopkHeap h(kk); float T=0.0f, Tt=floor; const float* norms=ix.norms.data(); DeletedDocs& deleted=ix.deleted; bool bDeleted=deleted.deleted()>0; //Tt=T*theta prunes
+    int64_t work=0; bool bBudget=(deadlineMs>0 || postingsBudget>0), bStopped=false;
     std::vector<PLIter*> X; for (int i=0;i<listIters.size();i++) X.push_back(&listIters[i]);
     while (X.size()>0) {
       SORT_ITERS:
       sort(X.begin(), X.end(), PLICompID);
       //for (int i=0;i<X.size();i++) {std::cerr<<X[i]->id<<" ";} std::cerr<<std::endl;
       // pivot from threshold
-      int Pi=0; float Smax=0.0f; for (; Pi<X.size(); Pi++) {Smax+=X[Pi]->w*(1.2f+1.0f); if (Smax>T) break; }
+      int Pi=0; float Smax=0.0f; for (; Pi<X.size(); Pi++) {Smax+=X[Pi]->w*X[Pi]->maxs; if (Smax>Tt) break; }
       if (Pi>=X.size()) break; //done
       int Pid=X[Pi]->id;
       // advance to pivot
       if (Pi!=0 && X[0]->id != Pid) {
         for (int i=0; i<Pi; i++) { PLIter& pli=*X[i];
-          while (pli.id<Pid) { if (!pli.next()) { X.erase(X.begin()+i); i--; Pi--; break; } } //skip
+          if (!pli.skipTo(Pid)) { X.erase(X.begin()+i); i--; Pi--; } //skip
         }
         goto SORT_ITERS;
       }
       // add other iterators at Pid
-      for (; Pi<X.size(); Pi++) { if (Pi+1>=X.size() || X[Pi+1]->id!=Pid) break; Smax+=X[Pi+1]->w*(1.2f+1.0f); }
+      for (; Pi<X.size(); Pi++) { if (Pi+1>=X.size() || X[Pi+1]->id!=Pid) break; Smax+=X[Pi+1]->w*X[Pi+1]->maxs; }
       // score iterators at docid (early termination)
       int docid; float score=0.0f;
+      if (bDeleted && deleted.test(Pid)) goto ADVANCE_SCORED; // tombstone
       for (int i=0; i<=Pi; i++) {
         PLIter& pli=*X[i]; if (i==0) docid=pli.id; else if (pli.id!=docid) break;
         // BM25 see https://en.wikipedia.org/wiki/Okapi_BM25
-        float freq=pli.freq*fnorm;
-        float tf=freq*(1.2f+1.0f) / (freq + 1.2f*(1.0f - 0.75f + 0.75f*docs->getV(docid)/avgDocSize));
-        //std::cerr<<"pli.freq="<<pli.freq<<" doclength="<<docs->getV(docid)<<" avgDocSize="<<avgDocSize<<std::endl;
-        //std::cerr<<"tf="<<tf<<" tf*w="<<tf*pli.w<<std::endl;
-        score += tf*pli.w; Smax -= pli.w*(1.2f+1.0f);
-        if ((score+Smax)<=T) { goto ADVANCE_SCORED; }
+        score += Scorer<P>::tf(pli.freq,norms[docid])*pli.w; Smax -= pli.w*pli.maxs;
+        if ((score+Smax)<=Tt) { goto ADVANCE_SCORED; }
       }
-      if (h.add(docid,score)) { T=h.front().score; }
+      if (h.add(docid,score)) { T=h.front().score; Tt=std::max(T*theta,floor); }
       ADVANCE_SCORED:
+      work+=Pi+1;
       for (int i=0; i<=Pi; i++) { PLIter& pli=*X[i];
         if (!pli.next()) { X.erase(X.begin()+i); i--; Pi--; }
       }
+      if (bBudget && ((postingsBudget>0 && work>=postingsBudget) || (deadlineMs>0 && (work&0xFF)<=Pi && std::chrono::steady_clock::now()>=deadline))) { bStopped=true; break; } //clock read about every 256 postings
+    }
+    if (bStopped) std::cerr<<"approximate results: budget exhausted after "<<work<<" postings"<<std::endl;
+    h.done();
+    return h;
+  }
+
+  // one list: blocks of postings scored together (a vectorizable loop without branches), stop once the threshold passes the list bound
+  template <class P> TopkHeap topk1(MSegments& ix, PLIter& pli, int kk, std::chrono::steady_clock::time_point deadline, float floor) {
+    TopkHeap h(kk); float T=0.0f, Tt=floor; const float* norms=ix.norms.data(); DeletedDocs& deleted=ix.deleted; bool bDeleted=deleted.deleted()>0;
+    int64_t work=0; bool bBudget=(deadlineMs>0 || postingsBudget>0), bStopped=false, more=true;
+    const int B=64; int32_t ids[B]; float fr[B], nr[B], sc[B]; const float w=pli.w, bound=pli.w*pli.maxs;
+    while (more && bound>Tt) {
+      int n=0; for (;n<B && more;n++) { ids[n]=pli.id; fr[n]=pli.freq; more=pli.next(); }
+      for (int i=0;i<n;i++) { nr[i]=norms[ids[i]]; }
+      for (int i=0;i<n;i++) { sc[i]=Scorer<P>::tf(fr[i],nr[i])*w; }
+      for (int i=0;i<n;i++) { if (sc[i]>Tt && !(bDeleted && deleted.test(ids[i])) && h.add(ids[i],sc[i])) { T=h.front().score; Tt=std::max(T*theta,floor); } }
+      work+=n;
+      if (bBudget && ((postingsBudget>0 && work>=postingsBudget) || (deadlineMs>0 && std::chrono::steady_clock::now()>=deadline))) { bStopped=more; break; }
+    }
+    if (bStopped) std::cerr<<"approximate results: budget exhausted after "<<work<<" postings"<<std::endl;
+    h.done();
+    return h;
+  }
+
+  // wide queries term-at-a-time: lists added into a float accumulator per docid range (L2 sized block), then a threshold scan of the block,
+  // no per document pivot sort; budgets stop after a block (results exact for the docids before it)
+  template <class P> TopkHeap taat(MSegments& ix, /*in*/PLIV& listIters, int kk, std::chrono::steady_clock::time_point deadline, float floor) {
+    TopkHeap h(kk); float T=0.0f, Tt=floor; const float* norms=ix.norms.data(); DeletedDocs& deleted=ix.deleted; bool bDeleted=deleted.deleted()>0;
+    int64_t work=0; bool bBudget=(deadlineMs>0 || postingsBudget>0), bStopped=false;
+    const int A=TaatBlock, B=64; std::vector<float> acc(std::min(A,std::max(ix.doccount,1)),0.0f); float* a=acc.data();
+    int32_t ids[B]; float fr[B], sc[B]; std::vector<char> more(listIters.size(),1); int live=listIters.size();
+    for (int lo=0; lo<ix.doccount && live>0; lo+=A) { int hi=std::min(lo+A,ix.doccount);
+      for (int i=0;i<listIters.size();i++) { PLIter& pli=listIters[i]; if (!more[i] || pli.id>=hi) continue; const float w=pli.w;
+        while (more[i] && pli.id<hi) { // postings of the block in chunks, scored in a vectorizable loop
+          int n=0; for (;n<B && more[i] && pli.id<hi;n++) { ids[n]=pli.id; fr[n]=pli.freq; more[i]=pli.next(); }
+          for (int j=0;j<n;j++) { sc[j]=Scorer<P>::tf(fr[j],norms[ids[j]])*w; }
+          for (int j=0;j<n;j++) { a[ids[j]-lo]+=sc[j]; }
+          work+=n; }
+        live-=!more[i]; }
+      // threshold scan, 16 accumulators compared at a time (branch-free count), candidates in docid order as the WAND loop
+      for (int d=0; d<hi-lo; d+=16) { int e=std::min(16,hi-lo-d), c=0; const float* x=a+d;
+        for (int j=0;j<e;j++) { c+=(x[j]>Tt); }
+        if (c>0) { for (int j=0;j<e;j++) { if (x[j]>Tt && !(bDeleted && deleted.test(lo+d+j)) && h.add(lo+d+j,x[j])) { T=h.front().score; Tt=std::max(T*theta,floor); } } } }
+      std::fill(a,a+(hi-lo),0.0f);
+      if (bBudget && live>0 && ((postingsBudget>0 && work>=postingsBudget) || (deadlineMs>0 && std::chrono::steady_clock::now()>=deadline))) { bStopped=true; break; }
+    }
+    if (bStopped) std::cerr<<"approximate results: budget exhausted after "<<work<<" postings"<<std::endl;
+    h.done();
+    return h;
+  }
+
+  // two lists: union in docid order until the threshold passes the lower bound list, then only probe it at the other list's documents (MaxScore)
+  template <class P> TopkHeap topk2(MSegments& ix, PLIter& x, PLIter& y, int kk, std::chrono::steady_clock::time_point deadline, float floor) {
+    TopkHeap h(kk); float T=0.0f, Tt=floor; const float* norms=ix.norms.data(); DeletedDocs& deleted=ix.deleted; bool bDeleted=deleted.deleted()>0;
+    int64_t work=0; bool bBudget=(deadlineMs>0 || postingsBudget>0), bStopped=false;
+    PLIter* a=&x; PLIter* b=&y; float ba=a->w*a->maxs, bb=b->w*b->maxs; if (ba<bb) { std::swap(a,b); std::swap(ba,bb); } // a has the higher bound
+    bool ea=true, eb=true; //lists not at end
+    while ((ea?ba:0.0f)+(eb?bb:0.0f)>Tt) {
+      int docid; float score=0.0f;
+      if (ea && (!eb || bb<=Tt || a->id<=b->id)) { docid=a->id; // a drives (b non-essential, ended or later)
+        if (bDeleted && deleted.test(docid)) { ea=a->next(); work++; continue; } // tombstone
+        score=Scorer<P>::tf(a->freq,norms[docid])*a->w;
+        if (eb && (b->id==docid || (bb<=Tt && score+bb>Tt && b->id<docid && (eb=b->skipTo(docid)) && b->id==docid))) { score+=Scorer<P>::tf(b->freq,norms[docid])*b->w; eb=b->next(); work++; }
+        ea=a->next(); work++; }
+      else { docid=b->id; // b alone at docid
+        if (!(bDeleted && deleted.test(docid))) score=Scorer<P>::tf(b->freq,norms[docid])*b->w;
+        eb=b->next(); work++; }
+      if (score>Tt && h.add(docid,score)) { T=h.front().score; Tt=std::max(T*theta,floor); }
+      if (bBudget && ((postingsBudget>0 && work>=postingsBudget) || (deadlineMs>0 && (work&0xFF)<=1 && std::chrono::steady_clock::now()>=deadline))) { bStopped=true; break; } //clock read about every 256 postings
     }
+    if (bStopped) std::cerr<<"approximate results: budget exhausted after "<<work<<" postings"<<std::endl;
     h.done();
-    // output
-    for (int i=0;i<h.size()&&h[i].docid>=0;i++) { char c[1<<10]; docs->getK(h[i].docid,c,1<<10); out<<prefix<<c<<"\t"<<i+1<<"\t"<<h[i].score<<std::endl; }
+    return h;
+  }
+
+  void output(MSegments& ix, /*in*/const std::string& prefix, const std::vector<Scored>& h, std::ostream& out) {
+    for (int i=0;i<h.size()&&h[i].docid>=0;i++) { char c[1<<10]; ix.docname(h[i].docid,c,1<<10); out<<prefix<<c<<"\t"<<i+1<<"\t"<<h[i].score<<std::endl;
+      if (store!=NULL) { std::vector<DocLoc> v; store->find(c,v); std::string t; for (int j=0;j<v.size();j++) { store->read(v[j],t); out<<t; } } }
+  }
+  template <class P> void doQuery(MSegments& ix, /*in*/const std::string& prefix, /*in*/PLIV& listIters, std::ostream& out, int doccount, std::chrono::steady_clock::time_point deadline) {
+    weigh(listIters,doccount);
+    TopkHeap h=topk<P>(ix,listIters,k,deadline);
+    output(ix,prefix,h,out);
+  }
+
+  // add the score of weighted lists at ascending docids
+  template <class P> void rescore(MSegments& ix, PLIV listIters, const std::vector<int>& docids, /*in/out*/std::vector<float>& scores) {
+    for (int i=0;i<listIters.size();i++) { PLIter& pli=listIters[i];
+      for (int j=0;j<docids.size();j++) { if (!pli.skipTo(docids[j])) break;
+        if (pli.id==docids[j]) scores[j]+=Scorer<P>::tf(pli.freq,ix.norms[docids[j]])*pli.w; } }
+  }
+
+  // math sub-index: text and math tuple terms evaluated concurrently with their own WAND thresholds, fused by sum (alpha is in the weights),
+  // exact: candidates of both sides rescored on both, then if the fused k-th score is below the sum of the sides' k-th scores (a document outside
+  // both could beat it) the combined lists are evaluated, pruned from the start by that k-th score
+  template <class P> void fuse(MSegments& ix, /*in*/const std::string& prefix, std::vector<QTerm>& terms, SharedPLs* shared, std::chrono::steady_clock::time_point deadline) {
+    std::vector<QTerm> tt, mt; for (int i=0;i<terms.size();i++) { (isMathTuple(terms[i].token.c_str())?mt:tt).push_back(terms[i]); }
+    PLIV tl, ml; getIterators(ix,tt,tl,shared); getIterators(*ix.math,mt,ml,shared,ix.segs.size());
+    bound<P>(tl); bound<P>(ml); weigh(tl,ix.doccount); weigh(ml,ix.doccount);
+    if (ml.size()==0 || tl.size()==0) { PLIV& l=(ml.size()==0?tl:ml); TopkHeap h=topk<P>(ix,l,k,deadline); output(ix,prefix,h,std::cout); return; } // one side
+    PLIV tb=tl, mb=ml; TopkHeap th(k), mh(k);
+    { std::thread t([&]() { mh=topk<P>(ix,ml,k,deadline); }); th=topk<P>(ix,tl,k,deadline); t.join(); }
+    std::vector<int> c; for (int i=0;i<k;i++) { if (th[i].docid>=0) c.push_back(th[i].docid); if (mh[i].docid>=0) c.push_back(mh[i].docid); }
+    std::sort(c.begin(),c.end()); c.erase(std::unique(c.begin(),c.end()),c.end());
+    std::vector<float> sc(c.size(),0.0f);
+    if (bFuseApprox) { for (int i=0;i<k;i++) { // sides' scores only, a missing side counts 0
+        if (th[i].docid>=0) sc[std::lower_bound(c.begin(),c.end(),th[i].docid)-c.begin()]+=th[i].score;
+        if (mh[i].docid>=0) sc[std::lower_bound(c.begin(),c.end(),mh[i].docid)-c.begin()]+=mh[i].score; } }
+    else { rescore<P>(ix,tb,c,sc); rescore<P>(ix,mb,c,sc); }
+    std::vector<Scored> f; for (int i=0;i<c.size();i++) { f.push_back(Scored(c[i],sc[i])); }
+    std::stable_sort(f.begin(),f.end(),mincomp); if (f.size()>k) f.resize(k,EmptyScore);
+    float bound=(th[k-1].docid>=0?th[k-1].score:0.0f)+(mh[k-1].docid>=0?mh[k-1].score:0.0f), kth=(f.size()>=k?f[k-1].score:0.0f);
+    if (!bFuseApprox && kth<bound) { PLIV all=tb; all.insert(all.end(),mb.begin(),mb.end()); all.pins.insert(all.pins.end(),mb.pins.begin(),mb.pins.end());
+      TopkHeap h=topk<P>(ix,all,k,deadline,kth*0.9999f); output(ix,prefix,h,std::cout); return; } // fused k-th score prunes from the start (below it for rounding)
+    output(ix,prefix,f,std::cout);
+  }
+
+  // tf part bounds of the policy (stats and the default are for BM25)
+  template <class P> inline void bound(/*in/out*/PLIV& listIters) { if (P::delta!=0.0f) { for (int i=0;i<listIters.size();i++) { listIters[i].maxs+=P::delta; } } }
+
+  // one query with scoring policy P
+  template <class P> void runP(MSegments& ix, const std::string& prefix, std::vector<QTerm> terms, SharedPLs* shared) {
+    std::chrono::steady_clock::time_point deadline=std::chrono::steady_clock::now()+std::chrono::milliseconds(deadlineMs);
+    for (int i=0;i<terms.size();i++) { terms[i].weight=Scorer<P>::weight(terms[i].token.c_str(),terms[i].weight,alpha); }
+    if (ix.math!=NULL) { fuse<P>(ix, prefix, terms, shared, deadline); return; }
+    // find postings lists and query
+    PLIV listIters; getIterators(ix, terms, listIters, shared); bound<P>(listIters);
+    //std::cerr<<"found "<<listIters.size()<<" lists"<<std::endl;
+    doQuery<P>(ix, prefix, listIters, std::cout, ix.doccount, deadline);
   }
 
 public:
-  MSearch() { bMath=false; alpha=0.18f; docs=NULL; totaltokens=0; dict=NULL; pffd=-1; mmpf=NULL; pfsize=0; k=10; }
-  virtual ~MSearch() { if (docs!=NULL) delete docs; docs=NULL;
-    if (dict!=NULL) delete dict; dict=NULL;
-    if (mmpf!=NULL) munmap(mmpf,pfsize); mmpf=NULL;
-    if (pffd>=0) close(pffd); pffd=-1; pfsize=0; }
+  MSearch() { store=NULL; bMath=false; bNormalize=false; alpha=0.18f; bFuseApprox=false; bPlus=false; bGeneric=false; k=10; taatWidth=8; deadlineMs=0; postingsBudget=0; theta=1.0f; planBudget=0; reloadSecs=0; bStop=false; hotnext=0; }
+  virtual ~MSearch() { if (cache.enabled()) cache.stats(); { std::lock_guard<std::mutex> l(wm); bStop=true; } wcv.notify_all(); if (watcher.joinable()) watcher.join();
+    if (store!=NULL) delete store; store=NULL; }
   void setk(int t) { if (t<=0) {std::cerr<<"ERROR: invalid k="<<t<<std::endl;exit(-1);} k=t; }
+  void setDocStore(cchar* fn) { if (store==NULL) store=new DocStore(); store->load(fn); }
+  void setReload(int secs) { if (secs<=0) {std::cerr<<"ERROR: invalid reload interval "<<secs<<std::endl; exit(-1);} reloadSecs=secs; }
+  void setCache(int mb) { if (mb<=0) {std::cerr<<"ERROR: invalid cache size "<<mb<<std::endl; exit(-1);} cache.setCap((uint64_t)mb<<20); }
+  void setWarm(cchar* fn) { std::ifstream in(fn); if (!in) {std::cerr<<"ERROR: loading warm-up tokens "<<fn<<std::endl; exit(-1);}
+    for (std::string line;getline(in,line);) { if (line.compare("")!=0) warm.push_back(line); } }
+  void setDeadline(int ms) { if (ms<=0) {std::cerr<<"ERROR: invalid deadline "<<ms<<std::endl; exit(-1);} deadlineMs=ms; }
+  void setPostingsBudget(int64_t n) { if (n<=0) {std::cerr<<"ERROR: invalid postings budget "<<n<<std::endl; exit(-1);} postingsBudget=n; }
+  void setPlanBudget(int64_t n) { if (n<=0) {std::cerr<<"ERROR: invalid plan budget "<<n<<std::endl; exit(-1);} planBudget=n; }
+  void setTaatWidth(int n) { if (n<0) {std::cerr<<"ERROR: invalid term-at-a-time width "<<n<<std::endl; exit(-1);} taatWidth=n; }
+  void setTheta(float f) { if (f<1.0f) {std::cerr<<"ERROR: invalid threshold factor "<<f<<std::endl; exit(-1);} theta=f; }
   void setAlpha(float a) { if (a<0||a>1) {std::cerr<<"ERROR: invalid alpha "<<a<<std::endl; exit(-1);} alpha=a; }
 
-  void query(std::string query) {
-    std::chrono::high_resolution_clock::time_point s=std::chrono::high_resolution_clock::now();
+  // normalize, split off the query name, tokenize, false if empty
+  bool parse(std::string query, /*out*/std::string& prefix, std::vector<QTerm>& terms) {
+    // same as external mtokenize -q (case folding, stemming, tuples, stopwords, keywords)
+    if (bNormalize) { normalizer.processQuery(&query[0],query.length(),normalized,normerr,normv);
+      query.assign(normalized.data(),normalized.length()-1); normalized.clear(); std::cerr<<normerr; normerr.clear(); }
     // named vs normal
-    std::string prefix="", qname=""; size_t cut=query.find(';');
+    std::string qname=""; prefix=""; size_t cut=query.find(';');
     if (cut!=std::string::npos) { qname=query.substr(0,cut); prefix=qname+"\t"; query=query.substr(cut+1); }
     std::cerr<<"query: "<<(true&&cut!=std::string::npos?qname:query)<<std::endl;
     // split into tokens
     MTokenizer::TokenList tokens; tokenizer.process(query.c_str(),query.length(),tokens);
-    if (tokens.size()<=0) {std::cerr<<"empty query"<<std::endl; return;}
+    if (tokens.size()<=0) {std::cerr<<"empty query"<<std::endl; return false;}
     //{ ofstream out("queries-processed.txt",std::ios_base::app); out<<qname<<";"; for (int i=0;i<tokens.size();i++) { out<<" "<<tokens[i]; } out<<std::endl; return; }
     //{ for (int i=0;i<tokens.size();i++) { std::cout<<" "<<tokens[i]; } std::cout<<std::endl; return; }
     //std::cerr<<"found "<<tokens.size()<<" tokens"<<std::endl;
-    // stats
-    int doccount=docs->size(); float avgDocSize=(double)totaltokens/doccount;
-    //std::cerr<<"avgDocSize="<<avgDocSize<<std::endl;
-    // find postings lists and query
-    PLIV listIters; getIterators(tokens, listIters);
-    //std::cerr<<"found "<<listIters.size()<<" lists"<<std::endl;
-    doQuery(prefix, listIters, std::cout, doccount, avgDocSize);
+    getTerms(tokens, terms);
+    return true;
+  }
+
+  void run(MSegments& ix, const std::string& prefix, std::vector<QTerm>& terms, SharedPLs* shared=NULL) {
+    if (bPlus) { if (bMath) runP<BM25PlusMath>(ix,prefix,terms,shared); else runP<BM25Plus>(ix,prefix,terms,shared); }
+    else { if (bMath) runP<BM25Math>(ix,prefix,terms,shared); else runP<BM25>(ix,prefix,terms,shared); }
+  }
+
+  void query(const std::string& query) {
+    std::chrono::high_resolution_clock::time_point s=std::chrono::high_resolution_clock::now();
+    std::string prefix; std::vector<QTerm> terms; if (!parse(query,prefix,terms)) return;
+    std::shared_ptr<MSegments> ix=std::atomic_load(&current); // snapshot kept until this query is done
+    cache.attach(ix);
+    run(*ix, prefix, terms);
     std::chrono::high_resolution_clock::time_point e=std::chrono::high_resolution_clock::now();
     std::cerr<<"Query took "<<(double)std::chrono::duration_cast<std::chrono::microseconds>(e-s).count()/1000<<"ms"<<std::endl;
   }
 
-  void input(const char* fn) {
-    //std::chrono::high_resolution_clock::time_point s=std::chrono::high_resolution_clock::now();
-    std::string line;
-    // postfile
-    if (pffd>=0 || mmpf!=NULL || pfsize!=0) {std::cerr<<"ERROR: only supporting one index file"<<std::endl; exit(-1);}
-    pffd=open(fn,O_RDONLY); struct stat sbindex; fstat(pffd, &sbindex); pfsize=sbindex.st_size;
-    if (pffd<0) {std::cerr<<"ERROR: Could not open input file "<<fn<<std::endl; exit(-1);}
-    mmpf=(char*)mmap(NULL, pfsize, PROT_READ, MAP_SHARED, pffd, 0);
-    if (mmpf==MAP_FAILED) {std::cerr<<"ERROR: failed memory map of index file "<<fn<<std::endl; exit(-1);}
-    std::cerr<<"Mapped index "<<fn<<" size "<<pfsize<<std::endl;
-    char* x=mmpf; line=getlinepf(x); if (*x!='\n') {std::cerr<<"ERROR: Bad or empty input file "<<fn<<std::endl; exit(-1);}
-    if (!(bMath && line.compare("math.mindex.1")==0) && line.compare("text.mindex.1")!=0) {std::cerr<<"ERROR: Unknown file format "<<fn<<" "<<line<<std::endl; exit(-1);} // external math tokenizer goes to text.mindex.1
-    //volatile char touch=0; for (char* p=mmpf; p<mmpf+pfsize; p+=1<<12) { touch+=*p; } //force load into memory
-    // meta
-    std::string metafn=(std::string)fn+".meta"; std::ifstream metain(metafn); if (!metain) {std::cerr<<"ERROR: loading meta file "<<metafn<<std::endl; exit(-1);}
-    struct stat sb; int er=stat(fn,&sb); uint64_t fsize=(uint64_t)sb.st_size; uint64_t t; metain>>t; if (er==-1 || t!=fsize) {std::cerr<<"ERROR: meta "<<metafn<<" wrong size match for "<<fn<<std::endl; exit(-1);}
-    getline(metain,line); if (line.compare("")!=0) {std::cerr<<"ERROR: meta "<<metafn<<" extra size match info "<<line<<std::endl; exit(-1);}
-    docs=new DocnamesTwoLayer(metain,metafn.c_str()); metain>>totaltokens; getline(metain,line); if (line.compare("")!=0) {std::cerr<<"ERROR: meta "<<metafn<<" extra totaltokens "<<line<<std::endl; exit(-1);}
-    dict=new DictionaryTwoLayer(metain,metafn.c_str()); metain.close();
-    //std::chrono::high_resolution_clock::time_point e=std::chrono::high_resolution_clock::now();
-    //std::cerr<<"Input "<<metafn<<" took "<<(double)std::chrono::duration_cast<std::chrono::microseconds>(e-s).count()/1000 <<"ms"<<std::endl;
-    std::cerr<<"loaded (docs="<<docs->size()<<",tt="<<totaltokens<<",terms="<<dict->size()<<")"<<std::endl;
+  // batch of queries: postings lists of tokens used by more than one query are decoded once for the batch
+  void queryBatch(const std::vector<std::string>& queries) {
+    std::chrono::high_resolution_clock::time_point s=std::chrono::high_resolution_clock::now();
+    std::vector<std::string> prefixes(queries.size()); std::vector<std::vector<QTerm>> terms(queries.size());
+    std::unordered_map<std::string,int> uses;
+    for (int i=0;i<queries.size();i++) { if (!parse(queries[i],prefixes[i],terms[i])) continue;
+      for (int j=0;j<terms[i].size();j++) { uses[terms[i][j].token]++; } }
+    std::shared_ptr<MSegments> ix=std::atomic_load(&current); // one snapshot for the batch
+    cache.attach(ix);
+    SharedPLs shared; for (auto& u : uses) { if (u.second>1) shared[u.first].resize(ix->segs.size()+(ix->math!=NULL?ix->math->segs.size():0)); }
+    for (int i=0;i<queries.size();i++) { if (terms[i].size()>0) run(*ix, prefixes[i], terms[i], &shared); }
+    uint64_t n=0; for (auto& sh : shared) { for (int j=0;j<sh.second.size();j++) { n+=sh.second[j].size()/2; } }
+    std::chrono::high_resolution_clock::time_point e=std::chrono::high_resolution_clock::now();
+    std::cerr<<"Batch of "<<queries.size()<<" queries, "<<uses.size()<<" tokens, "<<shared.size()<<" shared lists ("<<n<<" postings decoded once) took "
+      <<(double)std::chrono::duration_cast<std::chrono::microseconds>(e-s).count()/1000<<"ms"<<std::endl;
+  }
+
+  // single mindex, or manifest of segments (mseg), watched for replacement with -R
+  void input(const char* f) {
+    if (current!=NULL) {std::cerr<<"ERROR: only supporting one index file"<<std::endl; exit(-1);}
+    fn=f; if (reloadSecs>0) current.reset(MSegments::load(f,bMath),reclaim); else current.reset(MSegments::load(f,bMath));
+    if (cache.enabled() && warm.size()>0) { cache.attach(current); int n=0; // fill from the warm-up list (index loaded at startup)
+      for (int i=0;i<warm.size();i++) { for (int j=0;j<current->segs.size();j++) { MSegment& sg=*current->segs[j];
+        uint64_t loc=sg.dict->getV(warm[i].c_str()); if (loc==IntDeltaV::UNKNOWN) continue;
+        std::string t; PLIter pli=loadPL(sg,loc,0.0f,t); if (pli.plsize<PostingsCache::MinPostings) continue;
+        PostingsCache::Pairs v=std::make_shared<std::vector<int32_t>>(); pli.decode(*v); cache.put(j,loc,v); n++; } }
+      std::cerr<<"Warmed postings cache with "<<n<<" lists"<<std::endl; }
+    if (reloadSecs>0) watcher=std::thread([this]() { watch(); });
   }
 
   void dumpDictionary() {
-    std::ostream& out=std::cout;
-    for (int i=0;i<dict->size();i++) {
-      uint64_t loc=dict->getV(i);
-      std::string t; PLIter pli=loadPL(loc,0.0f,t);
-      out<<pli.plsize<<"\t"<<t<<std::endl;
+    std::ostream& out=std::cout; MSegments& ix=*current;
+    for (int j=0;j<ix.segs.size();j++) { MSegment& sg=*ix.segs[j];
+      for (int i=0;i<sg.dict->size();i++) {
+        uint64_t loc=sg.dict->getV(i);
+        std::string t; PLIter pli=loadPL(sg,loc,0.0f,t);
+        out<<pli.plsize<<"\t"<<t<<std::endl;
+      }
     }
   }
 };
 
-static void usage() {std::cerr<<"Usage: ./msearch.exe [-k#] [-M] [-a#.#] [-dd] data.mindex < query.txt"<<std::endl<<"  where -k number to return, -M math, -a alpha math/text balance, -dd dump dictionary"<<std::endl; exit(-1);}
+static void usage() {std::cerr<<"Usage: ./msearch.exe [-k#] [-M [-A]] [-a#.#] [-L] [-G] [-N] [-T keywords.txt] [-S stopwords.txt] [-X docs.docidx] [-R#] [-B#] [-C# [-W tokens.txt]] [-D#] [-P#] [-F#.#] [-E#] [-Q#] [-dd] data.mindex|index.mseg < query.txt"<<std::endl<<"  where -k number to return, -M math (with a math sub-index from mmerge -m: text and math tuples searched in parallel, fused exactly, -A approximately), -a alpha math/text balance, -L BM25+ scoring, -G general WAND loop for 1 and 2 term queries (for testing), -N normalize queries as mtokenize -q, -T -S -s as mtokenize (imply -N), -X output document text after each result (index from mextract -i), -R check every # seconds for a replaced index and swap it in, -B run batches of # queries decoding shared postings lists once, -C cache up to # MB of decoded hot postings lists (-W tokens to load first), -D stop each query after # ms or -P after scoring # postings (approximate results noted on stderr), -F WAND threshold factor >1 for faster approximate results, -E evaluate queries of at least # postings lists (default 8, 0 never) term-at-a-time, -Q drop low score bound per postings terms beyond # postings per query, -dd dump dictionary"<<std::endl; exit(-1);}
 
 int main(int argc, char *argv[]) {
   if (argc<2) usage();
-  MSearch ms; int s=1; bool dd=false;
+  MSearch ms; int s=1, batch=0; bool dd=false; char *T=NULL, *S=NULL; bool bstemS=true;
   for (;;) {
     if (s<argc && strstr(argv[s],"-k")==argv[s]) { ms.setk(std::stof(argv[s]+2)); s++; }
     else if (s<argc && strstr(argv[s],"-M")==argv[s] && *(argv[s]+2)==0) { ms.bMath=true; s++; }
+    else if (s<argc && strcmp(argv[s],"-A")==0) { ms.bFuseApprox=true; s++; }
     else if (s<argc && strstr(argv[s],"-a")==argv[s]) { ms.setAlpha(std::stof(argv[s]+2)); s++; }
+    else if (s<argc && strcmp(argv[s],"-L")==0) { ms.bPlus=true; s++; }
+    else if (s<argc && strcmp(argv[s],"-G")==0) { ms.bGeneric=true; s++; }
+    else if (s<argc && strstr(argv[s],"-N")==argv[s]) { ms.bNormalize=true; s++; }
+    else if (s<argc && strstr(argv[s],"-T")==argv[s]) { if (s+1>=argc) usage(); T=argv[s+1]; ms.bNormalize=true; s+=2; }
+    else if (s<argc && strstr(argv[s],"-S")==argv[s]) { if (s+1>=argc) usage(); S=argv[s+1]; ms.bNormalize=true; s+=2; }
+    else if (s<argc && strstr(argv[s],"-s")==argv[s]) { if (s+1>=argc) usage(); S=argv[s+1]; bstemS=false; ms.bNormalize=true; s+=2; }
+    else if (s<argc && strstr(argv[s],"-X")==argv[s]) { if (s+1>=argc) usage(); ms.setDocStore(argv[s+1]); s+=2; }
+    else if (s<argc && strstr(argv[s],"-R")==argv[s]) { ms.setReload(std::stoi(argv[s]+2)); s++; }
+    else if (s<argc && strstr(argv[s],"-B")==argv[s]) { batch=std::stoi(argv[s]+2); if (batch<1) usage(); s++; }
+    else if (s<argc && strstr(argv[s],"-C")==argv[s]) { ms.setCache(std::stoi(argv[s]+2)); s++; }
+    else if (s<argc && strstr(argv[s],"-W")==argv[s]) { if (s+1>=argc) usage(); ms.setWarm(argv[s+1]); s+=2; }
+    else if (s<argc && strstr(argv[s],"-D")==argv[s]) { ms.setDeadline(std::stoi(argv[s]+2)); s++; }
+    else if (s<argc && strstr(argv[s],"-P")==argv[s]) { ms.setPostingsBudget(std::stoll(argv[s]+2)); s++; }
+    else if (s<argc && strstr(argv[s],"-F")==argv[s]) { ms.setTheta(std::stof(argv[s]+2)); s++; }
+    else if (s<argc && strstr(argv[s],"-E")==argv[s]) { ms.setTaatWidth(std::stoi(argv[s]+2)); s++; }
+    else if (s<argc && strstr(argv[s],"-Q")==argv[s]) { ms.setPlanBudget(std::stoll(argv[s]+2)); s++; }
     else if (s<argc && strstr(argv[s],"-dd")==argv[s]) { dd=true; s++; }
     else if (argc-s!=1) usage();
     else break;
   }
+  // normalizer follows -M, words loaded after (as in mtokenize)
+  ms.normalizer.bMath=ms.bMath; ms.normalizer.bQuery=true;
+  if (S!=NULL) ms.normalizer.setS(S,bstemS);
+  if (T!=NULL) ms.normalizer.setT(T);
   ms.input(argv[s]); // from mindex
   if (dd) { ms.dumpDictionary(); return 0; }
   // query from stdin (until end or empty line)
   std::cerr<<"Enter queries:"<<std::endl;
+  if (batch>0) { for (bool more=true;more;) { std::vector<std::string> b;
+      for (;b.size()<batch;) { std::string line; getline(std::cin, line); if (!std::cin||line.compare("")==0) { more=false; break; } b.push_back(line); }
+      if (b.size()>0) ms.queryBatch(b); }
+    return 0; }
   for (;;) { std::string line; getline(std::cin, line); if (!std::cin||line.compare("")==0) break; ms.query(line); }
   return 0;
 }
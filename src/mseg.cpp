@@ -0,0 +1,82 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <cmath>
+
+#include "mmerge.hpp"
+#include "msegment.hpp"
+
+/* maintain a segment manifest: add new mindex segments (searchable immediately by msearch), merge similar sized neighbours */
+
+static uint64_t filesize(const std::string& fn) { struct stat sb; if (stat(fn.c_str(),&sb)!=0) {std::cerr<<"ERROR: missing segment "<<fn<<std::endl; exit(-1);} return sb.st_size; }
+static ino_t delinode(const std::string& fn) { struct stat sb; return (stat((fn+".del").c_str(),&sb)!=0?0:sb.st_ino); } // mdelete replaces .del by rename
+
+static void add(cchar* fn, const std::vector<std::string>& add) {
+  for (int i=0;i<add.size();i++) { filesize(add[i]); filesize(add[i]+".meta"); } // must be complete (minvert -o, mmerge -o or mencode)
+  MManifest m(fn); m.lock(); m.read();
+  for (int i=0;i<add.size();i++) { m.segs.push_back(add[i]); }
+  m.write(); m.unlock();
+  std::cerr<<"Manifest "<<fn<<" has "<<m.segs.size()<<" segments"<<std::endl;
+}
+
+// newest run of >=f adjacent segments in the same size tier (log base f), start index or -1
+static int pickRun(const std::vector<std::string>& segs, int f, /*out*/int& len) {
+  std::vector<int> tier; for (int i=0;i<segs.size();i++) { tier.push_back((int)(log((double)std::max((uint64_t)1,filesize(segs[i])))/log((double)f))); }
+  for (int e=segs.size();e>0;) { int s=e-1; for (;s>0 && tier[s-1]==tier[e-1];s--) {}
+    if (e-s>=f) { len=e-s; return s; }
+    e=s; }
+  return -1;
+}
+
+// tiered merging: merge a run into a new segment without holding the lock, then swap it into the manifest (segments may be added meanwhile)
+static void merge(cchar* fn, int f, int threads, bool bDelete, const PLFormat& fmt) {
+  for (int merged=0;;merged++) {
+    MManifest m(fn); m.lock(); m.read(); m.unlock();
+    int len; int s=pickRun(m.segs,f,len); if (s<0) { std::cerr<<"Merged "<<merged<<" runs, "<<m.segs.size()<<" segments"<<std::endl; return; }
+    std::vector<std::string> run(m.segs.begin()+s,m.segs.begin()+s+len);
+    std::vector<ino_t> dels; for (int i=0;i<len;i++) { dels.push_back(delinode(run[i])); }
+    std::string out; for (int n=1;;n++) { out=m.fn+"."+std::to_string(n)+".mindex"; struct stat sb; if (stat(out.c_str(),&sb)!=0) break; }
+    std::cerr<<"Merging "<<len<<" segments into "<<out<<std::endl;
+    mergeFiles(run,out.c_str(),threads,fmt);
+    m.lock(); m.read();
+    int at=-1; for (int i=0;i+len<=m.segs.size() && at<0;i++) { if (std::equal(run.begin(),run.end(),m.segs.begin()+i)) at=i; }
+    if (at<0) { m.unlock(); remove(out.c_str()); remove((out+".meta").c_str()); std::cerr<<"ERROR: manifest "<<fn<<" changed during merge"<<std::endl; exit(-1); }
+    bool bRedo=false; for (int i=0;i<len;i++) { bRedo|=(delinode(run[i])!=dels[i]); }
+    if (bRedo) { m.unlock(); remove(out.c_str()); remove((out+".meta").c_str()); std::cerr<<"Deletions during merge, redo"<<std::endl; merged--; continue; }
+    m.segs.erase(m.segs.begin()+at,m.segs.begin()+at+len); m.segs.insert(m.segs.begin()+at,out);
+    m.write(); m.unlock();
+    if (bDelete) { for (int i=0;i<len;i++) { remove(run[i].c_str()); remove((run[i]+".meta").c_str()); remove((run[i]+".del").c_str()); } } // open readers keep their mappings
+  }
+}
+
+static void usage() {
+  std::cerr<<"Usage: ./mseg.exe add index.mseg seg.mindex ..."<<std::endl;
+  std::cerr<<"       ./mseg.exe merge [-f#] [-t#] [-b#.#] [-e] [-d] index.mseg"<<std::endl;
+  std::cerr<<"       ./mseg.exe list index.mseg"<<std::endl;
+  std::cerr<<" where add appends complete segments (with .meta), merge combines runs of -f (default 4) adjacent segments of similar size"<<std::endl;
+  std::cerr<<"   into index.mseg.#.mindex until none remain (-t merge threads, -b -e list encodings as mmerge, -d delete merged segments), msearch loads index.mseg"<<std::endl;
+  exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc<3) usage();
+  std::string cmd=argv[1]; int s=2;
+  if (cmd.compare("add")==0) { if (argc<4) usage(); add(argv[2],std::vector<std::string>(argv+3,argv+argc)); return 0; }
+  if (cmd.compare("list")==0) { if (argc!=3) usage(); MManifest m(argv[2]); m.read();
+    for (int i=0;i<m.segs.size();i++) { std::cout<<filesize(m.segs[i])<<"\t"<<m.segs[i]<<std::endl; } return 0; }
+  if (cmd.compare("merge")!=0) usage();
+  int f=4, threads=1; bool bDelete=false; PLFormat fmt;
+  for (;;) {
+    if (s<argc && strstr(argv[s],"-f")==argv[s]) { f=std::stoi(argv[s]+2); if (f<2) usage(); s++; }
+    else if (s<argc && strstr(argv[s],"-t")==argv[s]) { threads=std::stoi(argv[s]+2); if (threads<1) usage(); s++; }
+    else if (s<argc && strstr(argv[s],"-b")==argv[s]) { fmt.density=std::stod(argv[s]+2); if (fmt.density<=0.0 || fmt.density>1.0) usage(); s++; }
+    else if (s<argc && strcmp(argv[s],"-e")==0) { fmt.bPEF=true; s++; }
+    else if (s<argc && strcmp(argv[s],"-d")==0) { bDelete=true; s++; }
+    else if (argc-s!=1) usage();
+    else break;
+  }
+  merge(argv[s],f,threads,bDelete,fmt);
+  return 0;
+}
@@ -0,0 +1,175 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <unistd.h> // for close
+#include <stdio.h> // for rename
+#include <sys/stat.h>
+#include <sys/fcntl.h> // for O_RDONLY
+#include <sys/mman.h> // for mmap
+#include <sys/file.h> // for flock
+
+// uses MMeta structures, so include after mmeta.hpp
+
+// == MSegment ======================================================
+// one mindex file memory mapped with its .meta loaded (docs, totaltokens, dict, optional stats),
+// docids of a multi-segment index are base+local docid
+
+class MSegment { public:
+  std::string fn; int pffd; char* mmpf; int64_t pfsize; //memory map of postfile
+  DocnamesTwoLayer* docs; uint64_t totaltokens; //docs(docname->docsize)
+  DictionaryTwoLayer* dict; //dict(token->location) points into postfile
+  std::vector<TermStat> stats; //optional per-term stats (dict order) from mencode -s
+  std::vector<uint> dfs; //optional per-term unpruned document frequencies (dict order) from mprune
+  DeletedDocs deleted; //optional tombstones from mdelete
+  int base;
+
+  bool bad; //failed to open without exit (bExit false), e.g. files replaced while hot swapping
+  MSegment(cchar* f, bool bMath, bool bExit=true) : fn(f) { std::string line; base=0; bad=false; docs=NULL; dict=NULL; mmpf=NULL; pfsize=0;
+    // postfile
+    pffd=open(f,O_RDONLY); if (pffd<0) { fail(bExit,"Could not open input file "+fn); return; }
+    struct stat sbindex; fstat(pffd, &sbindex); pfsize=sbindex.st_size;
+    mmpf=(char*)mmap(NULL, pfsize, PROT_READ, MAP_SHARED, pffd, 0);
+    if (mmpf==MAP_FAILED) { mmpf=NULL; fail(bExit,"failed memory map of index file "+fn); return; }
+    std::cerr<<"Mapped index "<<f<<" size "<<pfsize<<std::endl;
+    char* x=mmpf; line=getlinepf(x); if (*x!='\n') { fail(bExit,"Bad or empty input file "+fn); return; }
+    if (!(bMath && line.compare("math.mindex.1")==0) && line.compare("text.mindex.1")!=0) { fail(bExit,"Unknown file format "+fn+" "+line); return; } // external math tokenizer goes to text.mindex.1
+    //volatile char touch=0; for (char* p=mmpf; p<mmpf+pfsize; p+=1<<12) { touch+=*p; } //force load into memory
+    // meta (open files stay readable when replaced, so checked here once more without exit)
+    std::string metafn=fn+".meta"; std::ifstream metain(metafn); if (!metain) { fail(bExit,"loading meta file "+metafn); return; }
+    if (!bExit) { if (!MMeta::complete(metain)) { fail(bExit,"incomplete meta for "+fn); return; } metain.clear(); metain.seekg(0); }
+    uint64_t t; metain>>t; if (t!=(uint64_t)pfsize) { fail(bExit,"meta "+metafn+" wrong size match for "+fn); return; }
+    getline(metain,line); if (line.compare("")!=0) {std::cerr<<"ERROR: meta "<<metafn<<" extra size match info "<<line<<std::endl; exit(-1);}
+    docs=new DocnamesTwoLayer(metain,metafn.c_str()); metain>>totaltokens; getline(metain,line); if (line.compare("")!=0) {std::cerr<<"ERROR: meta "<<metafn<<" extra totaltokens "<<line<<std::endl; exit(-1);}
+    dict=new DictionaryTwoLayer(metain,metafn.c_str());
+    MMeta::readSections(metain,metafn.c_str(),dict->size(),stats,dfs);
+    if (stats.size()>0) std::cerr<<"Loaded term stats"<<std::endl; if (dfs.size()>0) std::cerr<<"Loaded unpruned document frequencies"<<std::endl;
+    metain.close();
+    if (deleted.read(f,docs->size())) std::cerr<<"Loaded "<<deleted.deleted()<<" deleted documents"<<std::endl;
+    std::cerr<<"loaded (docs="<<docs->size()<<",tt="<<totaltokens<<",terms="<<dict->size()<<")"<<std::endl;
+  }
+
+  virtual ~MSegment() { if (docs!=NULL) delete docs; docs=NULL;
+    if (dict!=NULL) delete dict; dict=NULL;
+    if (mmpf!=NULL) munmap(mmpf,pfsize); mmpf=NULL;
+    if (pffd>=0) close(pffd); pffd=-1; pfsize=0; }
+
+  // error exits, or a warning marking the segment bad
+  void fail(bool bExit, const std::string& msg) { if (bExit) {std::cerr<<"ERROR: "<<msg<<std::endl; exit(-1);} std::cerr<<"WARNING: "<<msg<<std::endl; bad=true; }
+
+  // index and meta pairing looks complete (no exit, for reloading while files are replaced)
+  static bool valid(cchar* f) { std::string line; uint64_t t=0; struct stat sb;
+    if (stat(f,&sb)!=0) {std::cerr<<"WARNING: missing "<<f<<std::endl; return false;}
+    { std::ifstream in(f); getline(in,line); if (line.compare("text.mindex.1")!=0 && line.compare("math.mindex.1")!=0) {std::cerr<<"WARNING: format "<<f<<std::endl; return false;} }
+    { std::ifstream in((std::string)f+".meta"); in>>t; if (!in || t!=(uint64_t)sb.st_size) {std::cerr<<"WARNING: meta size mismatch for "<<f<<std::endl; return false;} }
+    { std::ifstream in((std::string)f+".meta",std::ios::binary); if (!MMeta::complete(in)) {std::cerr<<"WARNING: incomplete meta for "<<f<<std::endl; return false;} }
+    return true;
+  }
+
+  // TODO: assumes token sizes are less than 2^14
+  inline std::string getlinepf(char*& x /*in/out*/) { char* e=x; for (;e<x+(1<<14)&&e<mmpf+pfsize;e++) { if (*e=='\n') break; } std::string r=std::string(x,e-x); if (e<mmpf+pfsize && *e=='\n') x=e; return r; }
+
+  // postings bytes of the (token \t bytelength \n data) record at loc, t is the token found there
+  inline byte* postings(uint64_t loc, /*out*/std::string& t, int& blen) {
+    if (loc>=pfsize) {std::cerr<<"ERROR: bad location "<<loc<<" max is "<<pfsize<<std::endl; exit(-1);}
+    char* x=mmpf+loc; std::istringstream in(getlinepf(x));
+    if (*x!='\n') {std::cerr<<"ERROR: bad token location data "<<std::string(x,1<<14)<<std::endl; exit(-1);}
+    // TODO: make index handle tokens with spaces
+    x++; in>>t; in>>blen;
+    { std::string line; getline(in,line); if (line.compare("")!=0) {std::cerr<<"ERROR: index extra postings info "<<t<<" "<<line<<std::endl; exit(-1);} }
+    volatile char touch=0; for (char* p=x; p<x+blen; p+=1<<12) { touch+=*p; } //force load into memory
+    { if (*(x+blen)!='\n') {std::cerr<<"ERROR: index extra postings "<<t<<std::endl; exit(-1);} }
+    return (byte*)x;
+  }
+};
+
+// == MManifest ======================================================
+// multi-segment index file: header line then one mindex file per line, oldest first (docids in this order),
+// changed by read-modify-write under an exclusive flock on fn.lock and replaced atomically with rename
+
+static const cchar* ManifestName="mindex.segments.1";
+
+class MManifest { protected: int lockfd;
+public:
+  std::string fn; std::vector<std::string> segs;
+  MManifest(cchar* f) : fn(f) { lockfd=-1; }
+  virtual ~MManifest() { unlock(); }
+
+  static bool isManifest(cchar* f) { std::ifstream in(f); std::string line; getline(in,line); return in && line.compare(ManifestName)==0; }
+
+  // missing file is an empty manifest
+  void read() { segs.clear(); std::ifstream in(fn); if (!in) return;
+    std::string line; getline(in,line); if (line.compare(ManifestName)!=0) {std::cerr<<"ERROR: Unknown file format "<<fn<<" "<<line<<std::endl; exit(-1);}
+    for (;getline(in,line);) { if (line.compare("")!=0) segs.push_back(line); }
+  }
+
+  void write() { std::string tmp=fn+".tmp";
+    { std::ofstream out(tmp); if (!out) {std::cerr<<"ERROR: Could not write "<<tmp<<std::endl; exit(-1);}
+      out<<ManifestName<<std::endl; for (int i=0;i<segs.size();i++) { out<<segs[i]<<std::endl; }
+      out.close(); if (!out) {std::cerr<<"ERROR: Could not write "<<tmp<<std::endl; exit(-1);} }
+    if (rename(tmp.c_str(),fn.c_str())!=0) {std::cerr<<"ERROR: Could not replace "<<fn<<std::endl; exit(-1);}
+  }
+
+  void lock() { if (lockfd>=0) return; std::string lfn=fn+".lock";
+    lockfd=open(lfn.c_str(),O_CREAT|O_RDWR,0644); if (lockfd<0 || flock(lockfd,LOCK_EX)!=0) {std::cerr<<"ERROR: Could not lock "<<lfn<<std::endl; exit(-1);} }
+  void unlock() { if (lockfd<0) return; flock(lockfd,LOCK_UN); close(lockfd); lockfd=-1; }
+};
+
+// == MSegments ======================================================
+// all segments of an index in docid order with global stats and tombstones, an immutable snapshot for queries,
+// a math index split by mmerge -m has its math tuples in the sub-index fn.math (same documents, its tombstones unused)
+
+class MSegments { public:
+  std::vector<MSegment*> segs; int doccount; uint64_t totaltokens; //segments in docid order, global stats
+  DeletedDocs deleted; //tombstones of all segments by global docid
+  MSegments* math; //optional math tuple sub-index
+  std::vector<float> norms; //BM25 length part of each global docid (Scorer norm), not for a sub-index
+  MSegments() { doccount=0; totaltokens=0; math=NULL; }
+  virtual ~MSegments() { for (int i=0;i<segs.size();i++) { delete segs[i]; } segs.clear(); if (math!=NULL) delete math; math=NULL; }
+
+  static inline bool hasMath(cchar* fn) { struct stat sb; return stat(((std::string)fn+".math").c_str(),&sb)==0; }
+
+  // single mindex, or manifest of segments (mseg)
+  static std::vector<std::string> files(cchar* fn) { std::vector<std::string> fns;
+    if (!MManifest::isManifest(fn)) fns.push_back(fn); else { MManifest m(fn); m.read(); fns=m.segs; }
+    return fns; }
+  static MSegments* load(cchar* fn, bool bMath, bool bSub=false, bool bExit=true) { std::vector<std::string> fns=files(fn);
+    if (fns.size()==0) { if (bExit) {std::cerr<<"ERROR: no segments in "<<fn<<std::endl; exit(-1);} std::cerr<<"WARNING: no segments in "<<fn<<std::endl; return NULL; }
+    MSegments* x=new MSegments();
+    for (int i=0;i<fns.size();i++) { MSegment* sg=new MSegment(fns[i].c_str(),bMath,bExit); if (sg->bad) { delete sg; delete x; return NULL; } sg->base=x->doccount;
+      x->doccount+=sg->docs->size(); x->totaltokens+=sg->totaltokens; x->segs.push_back(sg); }
+    x->deleted.resize(x->doccount); for (int i=0;i<x->segs.size();i++) { x->deleted.add(x->segs[i]->deleted,x->segs[i]->base); }
+    if (x->segs.size()>1) std::cerr<<"loaded "<<x->segs.size()<<" segments (docs="<<x->doccount<<",tt="<<x->totaltokens<<")"<<std::endl;
+    if (!bSub) { float avgDocSize=(double)x->totaltokens/x->doccount; x->norms.resize(x->doccount); // same float as the query loops
+      for (int i=0;i<x->segs.size();i++) { MSegment& sg=*x->segs[i]; for (int j=0;j<sg.docs->size();j++) { x->norms[sg.base+j]=Scorer<BM25>::norm(sg.docs->getV(j),avgDocSize); } } }
+    if (bMath && hasMath(fn)) { std::string mfn=(std::string)fn+".math"; x->math=load(mfn.c_str(),bMath,true,bExit);
+      if (x->math==NULL || x->math->math!=NULL || x->math->doccount!=x->doccount || x->math->totaltokens!=x->totaltokens) {
+        if (bExit) {std::cerr<<"ERROR: math sub-index "<<mfn<<" documents differ from "<<fn<<std::endl; exit(-1);}
+        std::cerr<<"WARNING: math sub-index "<<mfn<<" not loaded with "<<fn<<std::endl; delete x; return NULL; }
+      std::cerr<<"loaded math sub-index "<<mfn<<std::endl; }
+    return x;
+  }
+  // load without exit (NULL), for files replaced or removed between valid() and loading
+  static MSegments* tryLoad(cchar* fn, bool bMath) { return load(fn,bMath,false,false); }
+  static bool valid(cchar* fn) { std::vector<std::string> fns=files(fn); if (fns.size()==0) return false;
+    for (int i=0;i<fns.size();i++) { if (!MSegment::valid(fns[i].c_str())) return false; }
+    return (!hasMath(fn) || valid(((std::string)fn+".math").c_str())); }
+  // changes when any index file is replaced (inode, size, mtime of index, meta, deletions, math sub-index)
+  static std::string signature(cchar* fn, bool bSub=true) { std::string r; std::vector<std::string> f(1,fn), fns=files(fn);
+    for (int i=0;i<fns.size();i++) { f.push_back(fns[i]); f.push_back(fns[i]+".meta"); f.push_back(fns[i]+".del"); }
+    for (int i=0;i<f.size();i++) { struct stat sb; if (stat(f[i].c_str(),&sb)!=0) { r+="- "; continue; }
+      r+=std::to_string(sb.st_ino)+":"+std::to_string(sb.st_size)+":"+std::to_string(sb.st_mtim.tv_sec)+"."+std::to_string(sb.st_mtim.tv_nsec)+" "; }
+    if (bSub && hasMath(fn)) r+="math "+signature(((std::string)fn+".math").c_str(),false);
+    return r; }
+
+  // segment holding global docid
+  inline MSegment& seg(int docid) { int i=segs.size()-1; for (;i>0 && segs[i]->base>docid;i--) {} return *segs[i]; }
+  inline uint64_t docsize(int docid) { MSegment& sg=seg(docid); return sg.docs->getV(docid-sg.base); }
+  inline int docname(int docid, char* c, int cmax) { MSegment& sg=seg(docid); return sg.docs->getK(docid-sg.base,c,cmax); }
+};
@@ -0,0 +1,134 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <atomic>
+
+#include "mmerge.hpp"
+#include "msegment.hpp"
+
+/* space accounting and statistics of a mindex and its .meta, tab separated lines: section, name, values */
+
+class MStats { protected:
+  enum { VBYTE, BITMAP, PEF, ENCODINGS };
+  static const int Buckets=33; //log2 buckets, b holds [2^(b-1),2^b-1]
+  struct Big { uint64_t bytes; uint df; std::string token; inline bool operator<(const Big& o) const { return bytes>o.bytes || (bytes==o.bytes && token<o.token); } }; //largest first
+  struct Part { // per thread, summed after
+    uint64_t lists[ENCODINGS], postings[ENCODINGS], bytes[ENCODINGS]; //by list encoding
+    uint64_t records, headers, docids, freqs; //bytes: token lines, list headers (and padding), docid and freq data
+    uint64_t klists[2], kpostings[2], kbytes[2]; //text, math tuples
+    uint64_t blists[Buckets], bpostings[Buckets], bbytes[Buckets], tf[Buckets]; //by list length, postings by tf
+    uint64_t maxdf, maxtf; std::vector<Big> big;
+    Part() { memset(lists,0,sizeof(lists)); memset(postings,0,sizeof(postings)); memset(bytes,0,sizeof(bytes)); records=headers=docids=freqs=0;
+      memset(klists,0,sizeof(klists)); memset(kpostings,0,sizeof(kpostings)); memset(kbytes,0,sizeof(kbytes));
+      memset(blists,0,sizeof(blists)); memset(bpostings,0,sizeof(bpostings)); memset(bbytes,0,sizeof(bbytes)); memset(tf,0,sizeof(tf)); maxdf=maxtf=0; }
+    void add(const Part& o) { for (int i=0;i<ENCODINGS;i++) { lists[i]+=o.lists[i]; postings[i]+=o.postings[i]; bytes[i]+=o.bytes[i]; }
+      records+=o.records; headers+=o.headers; docids+=o.docids; freqs+=o.freqs;
+      for (int i=0;i<2;i++) { klists[i]+=o.klists[i]; kpostings[i]+=o.kpostings[i]; kbytes[i]+=o.kbytes[i]; }
+      for (int i=0;i<Buckets;i++) { blists[i]+=o.blists[i]; bpostings[i]+=o.bpostings[i]; bbytes[i]+=o.bbytes[i]; tf[i]+=o.tf[i]; }
+      maxdf=std::max(maxdf,o.maxdf); maxtf=std::max(maxtf,o.maxtf); big.insert(big.end(),o.big.begin(),o.big.end()); }
+  };
+  MSegment sg; Part all; uint64_t metasize;
+
+  static inline uint64_t digits(uint64_t v) { uint64_t n=1; for (;v>=10;v/=10) { n++; } return n; }
+
+  // bytes of a list split into header, docids and freqs (bitmap rank samples count as docids), checked against blen
+  static int components(byte* d, int blen, Part& p) { uint64_t h, id=0, fr=0; int e;
+    if (isBitmapPL(d)) { BitmapPL b(d); e=BITMAP; h=(b.words-d)+8; id=8*(uint64_t)b.nwords+4*(uint64_t)((b.nwords+7)/8); fr=((uint64_t)b.psize*b.fbits+7)/8; }
+    else if (isPEF(d)) { PEFList L(d); e=PEF; h=(L.parts-d)+8;
+      for (uint i=0;i<L.nparts;i++) { cbyte* q=L.part(i); uint n=L.count(i), l=q[0], fb=q[1], span=L.last(i)-L.lo(i);
+        h+=2; id+=((uint64_t)n*l+7)/8+((uint64_t)n+(span>>l)+1+7)/8; fr+=((uint64_t)n*fb+7)/8; } }
+    else { byte* x=d; byte* dend=d+blen; e=VBYTE; uint64_t psize=readVByte(x); if (psize>1) readVByte(x); h=x-d;
+      for (;x<dend;) { byte* y=x; readVByte(x); id+=x-y; y=x; readVByte(x); fr+=x-y; } }
+    if (h+id+fr!=(uint64_t)blen) {std::cerr<<"ERROR: postings size "<<blen<<" components "<<h<<"+"<<id<<"+"<<fr<<std::endl; exit(-1);}
+    p.headers+=h; p.docids+=id; p.freqs+=fr; return e;
+  }
+
+  void scan(int from, int to, Part& p) {
+    for (int i=from;i<to;i++) { uint64_t loc=sg.dict->getV(i); std::string t; int blen; byte* d=sg.postings(loc,t,blen);
+      uint df=0; int e=components(d,blen,p);
+      forPostings(d,d+blen,[&](uint id, uint freq) { df++; p.tf[bitsFor(freq)]++; p.maxtf=std::max(p.maxtf,(uint64_t)freq); });
+      int k=isMathTuple(t.c_str()), b=bitsFor(df);
+      p.lists[e]++; p.postings[e]+=df; p.bytes[e]+=blen; p.klists[k]++; p.kpostings[k]+=df; p.kbytes[k]+=blen;
+      p.blists[b]++; p.bpostings[b]+=df; p.bbytes[b]+=blen; p.maxdf=std::max(p.maxdf,(uint64_t)df);
+      p.records+=t.size()+1+digits(blen)+1+1; // token \t blen \n ... \n
+      p.big.push_back(Big{(uint64_t)blen,df,t}); if (p.big.size()>=2*largest) trim(p.big); }
+    trim(p.big);
+  }
+  inline void trim(std::vector<Big>& v) { std::sort(v.begin(),v.end()); if (v.size()>largest) v.resize(largest); }
+
+  static inline double ratio(uint64_t a, uint64_t b) { return (b==0?0.0:(double)a/b); }
+
+public:
+  int threads; uint largest;
+  MStats(cchar* fn) : sg(fn,true) { threads=1; largest=10; std::string m=(std::string)fn+".meta"; struct stat sb; metasize=(stat(m.c_str(),&sb)==0?sb.st_size:0); }
+
+  // terms in chunks handed out to the threads
+  void run() { int n=sg.dict->size(), chunk=256; std::atomic<int> next(0); std::vector<Part> parts(threads);
+    std::vector<std::thread> ts; for (int j=0;j<threads;j++) { ts.push_back(std::thread([&,j]() {
+      for (;;) { int s=next.fetch_add(chunk); if (s>=n) break; scan(s,std::min(n,s+chunk),parts[j]); } })); }
+    for (int j=0;j<threads;j++) { ts[j].join(); all.add(parts[j]); }
+    trim(all.big);
+  }
+
+  void output(std::ostream& out) { Part& p=all; uint n=sg.dict->size(), docs=sg.docs->size();
+    uint64_t postings=p.postings[VBYTE]+p.postings[BITMAP]+p.postings[PEF], lbytes=p.headers+p.docids+p.freqs;
+    uint64_t doctable=(n>0?(uint64_t)sg.dict->getV(0):sg.pfsize); // header lines and docsize \t docname lines before the first token
+    uint64_t dictbytes=sg.dict->memoryusage(), docnames=sg.docs->memoryusage(), stats=sg.stats.size()*sizeof(TermStat), dfs=sg.dfs.size()*sizeof(uint);
+    out<<"index\tdocs\t"<<docs<<std::endl<<"index\ttokens\t"<<sg.totaltokens<<std::endl<<"index\tterms\t"<<n<<std::endl<<"index\tpostings\t"<<postings<<std::endl;
+    out<<"index\tdeleted\t"<<sg.deleted.deleted()<<std::endl<<"index\tmaxdf\t"<<p.maxdf<<std::endl<<"index\tmaxtf\t"<<p.maxtf<<std::endl;
+    // files and their parts (bytes, share of the file)
+    out<<"space\tindex\t"<<sg.pfsize<<"\t1"<<std::endl;
+    out<<"space\tindex.doctable\t"<<doctable<<"\t"<<ratio(doctable,sg.pfsize)<<std::endl;
+    out<<"space\tindex.tokenlines\t"<<p.records<<"\t"<<ratio(p.records,sg.pfsize)<<std::endl;
+    out<<"space\tindex.listheaders\t"<<p.headers<<"\t"<<ratio(p.headers,sg.pfsize)<<std::endl;
+    out<<"space\tindex.docids\t"<<p.docids<<"\t"<<ratio(p.docids,sg.pfsize)<<std::endl;
+    out<<"space\tindex.freqs\t"<<p.freqs<<"\t"<<ratio(p.freqs,sg.pfsize)<<std::endl;
+    out<<"space\tindex.other\t"<<(int64_t)(sg.pfsize-doctable-p.records-lbytes)<<"\t"<<ratio(sg.pfsize-doctable-p.records-lbytes,sg.pfsize)<<std::endl; // 0 for a well formed index
+    out<<"space\tmeta\t"<<metasize<<"\t1"<<std::endl;
+    out<<"space\tmeta.docnames\t"<<docnames<<"\t"<<ratio(docnames,metasize)<<std::endl;
+    out<<"space\tmeta.dictionary\t"<<dictbytes<<"\t"<<ratio(dictbytes,metasize)<<std::endl;
+    out<<"space\tmeta.termstats\t"<<stats<<"\t"<<ratio(stats,metasize)<<std::endl;
+    out<<"space\tmeta.termdfs\t"<<dfs<<"\t"<<ratio(dfs,metasize)<<std::endl;
+    out<<"dictionary\tbytes_per_term\t"<<ratio(dictbytes,n)<<std::endl<<"dictionary\tbytes_per_doc\t"<<ratio(docnames,docs)<<std::endl;
+    // lists, postings, bytes, bits per posting, compression ratio against 2 uint32 per posting
+    cchar* enc[ENCODINGS]={"vbyte","bitmap","eliasfano"};
+    for (int i=0;i<ENCODINGS;i++) { out<<"encoding\t"<<enc[i]<<"\t"<<p.lists[i]<<"\t"<<p.postings[i]<<"\t"<<p.bytes[i]<<"\t"<<ratio(8*p.bytes[i],p.postings[i])<<"\t"<<ratio(8*p.postings[i],p.bytes[i])<<std::endl; }
+    cchar* kind[2]={"text","math"};
+    for (int i=0;i<2;i++) { out<<"kind\t"<<kind[i]<<"\t"<<p.klists[i]<<"\t"<<p.kpostings[i]<<"\t"<<p.kbytes[i]<<"\t"<<ratio(8*p.kbytes[i],p.kpostings[i])<<"\t"<<ratio(8*p.kpostings[i],p.kbytes[i])<<std::endl; }
+    // df distribution: lists by length bucket [lo,hi] with their space, tf distribution: postings by freq bucket
+    for (int b=1;b<Buckets;b++) { if (p.blists[b]==0) continue; uint64_t lo=1ull<<(b-1), hi=(1ull<<b)-1;
+      out<<"df\t"<<lo<<"-"<<hi<<"\t"<<p.blists[b]<<"\t"<<p.bpostings[b]<<"\t"<<p.bbytes[b]<<"\t"<<ratio(8*p.bbytes[b],p.bpostings[b])<<"\t"<<ratio(8*p.bpostings[b],p.bbytes[b])<<std::endl; }
+    for (int b=1;b<Buckets;b++) { if (p.tf[b]==0) continue; uint64_t lo=1ull<<(b-1), hi=(1ull<<b)-1;
+      out<<"tf\t"<<lo<<"-"<<hi<<"\t"<<p.tf[b]<<"\t"<<ratio(p.tf[b],postings)<<std::endl; }
+    // largest lists: token, df, bytes, bits per posting
+    for (int i=0;i<p.big.size();i++) { Big& g=p.big[i]; out<<"largest\t"<<g.token<<"\t"<<g.df<<"\t"<<g.bytes<<"\t"<<ratio(8*g.bytes,g.df)<<std::endl; }
+  }
+};
+
+static void usage() {
+  std::cerr<<"Usage: ./mstats.exe [-t#] [-n#] data.mindex > stats.tsv"<<std::endl;
+  std::cerr<<" where -t threads, -n number of largest lists (default 10), output lines are tab separated section, name, values:"<<std::endl;
+  std::cerr<<"   index counts, space (bytes and share of the index or meta file), dictionary bytes per term and per document,"<<std::endl;
+  std::cerr<<"   encoding, kind (text or math tuples) and df (list length bucket) with lists, postings, bytes, bits per posting and compression ratio"<<std::endl;
+  std::cerr<<"   against two uint32 per posting, tf (freq bucket) with postings and their share, largest with token, df, bytes, bits per posting"<<std::endl;
+  exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+  int s=1, threads=1, largest=10;
+  for (;;) {
+    if (s<argc && strstr(argv[s],"-t")==argv[s]) { threads=std::stoi(argv[s]+2); if (threads<1) usage(); s++; }
+    else if (s<argc && strstr(argv[s],"-n")==argv[s]) { largest=std::stoi(argv[s]+2); if (largest<0) usage(); s++; }
+    else if (argc-s!=1) usage();
+    else break;
+  }
+  MStats m(argv[s]); m.threads=threads; m.largest=largest;
+  std::chrono::high_resolution_clock::time_point st=std::chrono::high_resolution_clock::now();
+  m.run();
+  std::chrono::high_resolution_clock::time_point e=std::chrono::high_resolution_clock::now();
+  std::cerr<<"Scanned in "<<(double)std::chrono::duration_cast<std::chrono::milliseconds>(e-st).count()/1000<<"s using "<<threads<<" threads"<<std::endl;
+  m.output(std::cout);
+  return 0;
+}
@@ -6,42 +6,67 @@
 #include <iostream>
 #include <string>
 #include <cstring>
-#include <sstream>
 #include <stdio.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "mbatch.hpp"
 
 /* read in TREC files, strip html from DOC and output in TREC format */
 
-static bool pr[256];
+static bool pr[256]; static unsigned char lc[256];
 void setupPR() {
-  for (int i=0;i<256;i++) pr[i]=false;
+  for (int i=0;i<256;i++) { pr[i]=false; lc[i]=tolower(i); }
   pr['<']=pr['&']=pr['\r']=pr['\t']=pr['\v']=pr['\f']=pr['\n']=pr[' ']=true;
 }
 
+// index of next byte with pr[] set (or size), 32/16 bytes at a time
+static inline int nextpr(const char* data, int i, int size) {
+#ifdef __AVX2__
+  { const __m256i lt=_mm256_set1_epi8('<'), amp=_mm256_set1_epi8('&'), sp=_mm256_set1_epi8(' '), tab=_mm256_set1_epi8('\t'), four=_mm256_set1_epi8(4);
+  for (;i+32<=size;i+=32) { __m256i x=_mm256_loadu_si256((const __m256i*)(data+i)); __m256i t=_mm256_sub_epi8(x,tab); // \t..\r as unsigned t<=4
+    __m256i m=_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x,lt),_mm256_cmpeq_epi8(x,amp)),_mm256_or_si256(_mm256_cmpeq_epi8(x,sp),_mm256_cmpeq_epi8(_mm256_min_epu8(t,four),t)));
+    uint32_t b=_mm256_movemask_epi8(m); if (b!=0) return i+__builtin_ctz(b); } }
+#endif
+#ifdef __SSE2__
+  { const __m128i lt=_mm_set1_epi8('<'), amp=_mm_set1_epi8('&'), sp=_mm_set1_epi8(' '), tab=_mm_set1_epi8('\t'), four=_mm_set1_epi8(4);
+  for (;i+16<=size;i+=16) { __m128i x=_mm_loadu_si128((const __m128i*)(data+i)); __m128i t=_mm_sub_epi8(x,tab); // \t..\r as unsigned t<=4
+    __m128i m=_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x,lt),_mm_cmpeq_epi8(x,amp)),_mm_or_si128(_mm_cmpeq_epi8(x,sp),_mm_cmpeq_epi8(_mm_min_epu8(t,four),t)));
+    int b=_mm_movemask_epi8(m); if (b!=0) return i+__builtin_ctz(b); } }
+#endif
+  for (;i<size && !pr[(unsigned char)data[i]];i++) {}
+  return i;
+}
+
+// index of next c at or after i (or size)
+static inline int nextc(const char* data, int i, int size, char c) { const char* x=(i<size?(const char*)memchr(data+i,c,size-i):NULL); return (x==NULL?size:x-data); }
+
 #define REMAIN_2(s) i+2<size && data[i+1]==s[0] && data[i+2]==s[1]
 #define REMAIN_3(s) i+3<size && data[i+1]==s[0] && data[i+2]==s[1] && data[i+3]==s[2]
 
-#define REMAIN_5lower(s) i+5<size && tolower(data[i+1])==s[0] && tolower(data[i+2])==s[1] && tolower(data[i+3])==s[2] && tolower(data[i+4])==s[3] && tolower(data[i+5])==s[4]
+#define REMAIN_5lower(s) i+5<size && lc[(unsigned char)data[i+1]]==s[0] && lc[(unsigned char)data[i+2]]==s[1] && lc[(unsigned char)data[i+3]]==s[2] && lc[(unsigned char)data[i+4]]==s[3] && lc[(unsigned char)data[i+5]]==s[4]
 
-#define REMAIN_6lower(s) i+6<size && tolower(data[i+1])==s[0] && tolower(data[i+2])==s[1] && tolower(data[i+3])==s[2] && tolower(data[i+4])==s[3] && tolower(data[i+5])==s[4] && tolower(data[i+6])==s[5]
+#define REMAIN_6lower(s) i+6<size && lc[(unsigned char)data[i+1]]==s[0] && lc[(unsigned char)data[i+2]]==s[1] && lc[(unsigned char)data[i+3]]==s[2] && lc[(unsigned char)data[i+4]]==s[3] && lc[(unsigned char)data[i+5]]==s[4] && lc[(unsigned char)data[i+6]]==s[5]
 
-#define REMAIN_7lower(s) i+7<size && tolower(data[i+1])==s[0] && tolower(data[i+2])==s[1] && tolower(data[i+3])==s[2] && tolower(data[i+4])==s[3] && tolower(data[i+5])==s[4] && tolower(data[i+6])==s[5] && tolower(data[i+7])==s[6]
+#define REMAIN_7lower(s) i+7<size && lc[(unsigned char)data[i+1]]==s[0] && lc[(unsigned char)data[i+2]]==s[1] && lc[(unsigned char)data[i+3]]==s[2] && lc[(unsigned char)data[i+4]]==s[3] && lc[(unsigned char)data[i+5]]==s[4] && lc[(unsigned char)data[i+6]]==s[5] && lc[(unsigned char)data[i+7]]==s[6]
 
-#define REMAIN_8lower(s) i+8<size && tolower(data[i+1])==s[0] && tolower(data[i+2])==s[1] && tolower(data[i+3])==s[2] && tolower(data[i+4])==s[3] && tolower(data[i+5])==s[4] && tolower(data[i+6])==s[5] && tolower(data[i+7])==s[6] && tolower(data[i+8])==s[7]
+#define REMAIN_8lower(s) i+8<size && lc[(unsigned char)data[i+1]]==s[0] && lc[(unsigned char)data[i+2]]==s[1] && lc[(unsigned char)data[i+3]]==s[2] && lc[(unsigned char)data[i+4]]==s[3] && lc[(unsigned char)data[i+5]]==s[4] && lc[(unsigned char)data[i+6]]==s[5] && lc[(unsigned char)data[i+7]]==s[6] && lc[(unsigned char)data[i+8]]==s[7]
 
-void process(FILE* out, /*in*/ const char* data, int size, char whitespace=0) {
+void process(OutBuf& out, /*in*/ const char* data, int size, char whitespace=0) {
   for (int i=0;i<size;i++) {
     unsigned char c=data[i];
-    if (!pr[c]) { if (whitespace!=0) { putc(whitespace,out); whitespace=0; } putc(c,out); continue; }
+    if (!pr[c]) { if (whitespace!=0) { out.put(whitespace); whitespace=0; } int e=nextpr(data,i+1,size); out.write(data+i,e-i); i=e-1; continue; } // clean span
     switch (c) {
       case '<':
         // html comment
-        if (REMAIN_3("!--")) { for (i+=4;i<size;i++) { c=data[i]; if (c=='-'&& REMAIN_2("->")) { i+=2; break; } } c=' '; }
+        if (REMAIN_3("!--")) { for (i+=4;(i=nextc(data,i,size,'-'))<size;i++) { if (REMAIN_2("->")) { i+=2; break; } } c=' '; }
         // script tag
-        else if (REMAIN_6lower("script")) { for (i+=7;i<size;i++) { c=data[i]; if (c=='<'&& REMAIN_8lower("/script>")) { i+=8; break; } } c=' '; }
+        else if (REMAIN_6lower("script")) { for (i+=7;(i=nextc(data,i,size,'<'))<size;i++) { if (REMAIN_8lower("/script>")) { i+=8; break; } } c=' '; }
         // style tag
-        else if (REMAIN_5lower("style")) { for (i+=6;i<size;i++) { c=data[i]; if (c=='<'&& REMAIN_7lower("/style>")) { i+=7; break; } } c=' '; }
+        else if (REMAIN_5lower("style")) { for (i+=6;(i=nextc(data,i,size,'<'))<size;i++) { if (REMAIN_7lower("/style>")) { i+=7; break; } } c=' '; }
         // other tags
-        else { for (i++;i<size;i++) { c=data[i]; if (c=='>') { break; } } c=' '; }
+        else { i=nextc(data,i+1,size,'>'); c=' '; }
         break;
       case '&':
         // html &nbsp; escaping
@@ -52,51 +77,32 @@ void process(FILE* out, /*in*/ const char* data, int size, char whitespace=0) {
     }
     if (c==' ') { if (whitespace!='\n') whitespace=c; } // collapse whitespace, newline takes precedence
     else if (c=='\n') { whitespace=c; }
-    else { if (whitespace!=0) { putc(whitespace,out); whitespace=0; } putc(c,out); }
+    else { if (whitespace!=0) { out.put(whitespace); whitespace=0; } out.put(c); }
   }
 }
 
-int main(int argc, char *argv[]) {
-  setupPR();
-  // process all input without DOC,DOCNO,DOCHDR tags
-  if (argc==2 && strstr(argv[1],"-x")==argv[1]) {
-    std::ostringstream buffer; buffer<<std::cin.rdbuf(); // read all
-    std::string data = buffer.str(); process(stdout,data.c_str(),data.length()); std::cout<<std::endl; // process
-    return 0;
-  }
-  if (argc==2 && strstr(argv[1],"-q")==argv[1]) {
-    for (bool bfirst=true;;) { std::string line; getline(std::cin, line); if (!std::cin) break;
-      int tstart=line.rfind("Query topic=\"");
-      if (tstart>=0) { tstart+=13;
-        int tend=line.find("\"",tstart);
-        if (tend>=0) { if (bfirst) bfirst=false; else std::cout<<std::endl; std::cout<<line.substr(tstart,tend-tstart)<<";"; continue; }
-      }
-      process(stdout,line.c_str(),line.length(),(tstart>=0?0:' '));
-    } std::cout<<std::endl;
-    return 0;
-  }
-  // process with tags
-  if (argc!=1) { std::cerr<<"Usage: ./mstrip.exe [-x|-q] < input > output"<<std::endl<<"   where -x = no DOC tags, -q = math query file"; return -1; }
-  // data from stdin
+// strip a batch of whole DOCs (state machine restarts at each DOC)
+void processDocs(Batch& b) {
+  LineReader in(b.in); OutBuf& ob=b.out;
   int curr=0, size=1<<20; char* buff=(char*)malloc(size);
   NEXTDOC:
   std::string line;
   int docHDRLine=0;
-  for (;;) { getline(std::cin, line); if (!std::cin) goto CLEANUPBUFF;
+  for (;;) { if (!in.getline(line)) goto CLEANUPBUFF;
     if (docHDRLine<=0) {
-      if (line.compare("<DOC>")==0 || line.find("<DOCNO>")==0) { std::cout<<line<<std::endl; }
-      else if (line.compare("<DOCHDR>")==0 || docHDRLine>0) { docHDRLine++; std::cout<<line<<std::endl; }
+      if (line.compare("<DOC>")==0 || line.find("<DOCNO>")==0) { ob.line(line); }
+      else if (line.compare("<DOCHDR>")==0 || docHDRLine>0) { docHDRLine++; ob.line(line); }
       else { goto PROCESSLINE; } // no DOCHDR
     } else {
-      if (line.compare("</DOCHDR>")==0) { std::cout<<line<<std::endl; break; }
-      else if (docHDRLine<2) { docHDRLine++; std::cout<<line<<std::endl; } // pass through non-processed lines, but only first of DocHDR
+      if (line.compare("</DOCHDR>")==0) { ob.line(line); break; }
+      else if (docHDRLine<2) { docHDRLine++; ob.line(line); } // pass through non-processed lines, but only first of DocHDR
     }
   }
-  for (;;) { getline(std::cin, line); if (!std::cin) goto CLEANUPBUFF;
+  for (;;) { if (!in.getline(line)) goto CLEANUPBUFF;
     PROCESSLINE:
     if (line.compare("</DOC>")==0) {
-      process(stdout,buff,curr); std::cout<<std::endl; curr=0; // process accumulated at end of doc
-      std::cout<<line<<std::endl; // pass through non-processed lines
+      process(ob,buff,curr); ob.put('\n'); curr=0; // process accumulated at end of doc
+      ob.line(line); // pass through non-processed lines
       goto NEXTDOC;
     } else {
       int len=line.length();
@@ -106,5 +112,44 @@ int main(int argc, char *argv[]) {
   }
   CLEANUPBUFF:
   free(buff); buff=NULL;
+}
+
+static void usage() {
+  std::cerr<<"Usage: ./mstrip.exe [-x|-q|-t#] < input > output"<<std::endl;
+  std::cerr<<" where -x no DOC tags, -q math query file, -t threads (DOC input only, document order kept)"<<std::endl;
+  exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+  setupPR(); OutBuf ob; std::ios::sync_with_stdio(false); // all output via ob
+  int s=1, threads=0; bool bX=false, bQ=false;
+  for (;;) {
+    if (s<argc && strcmp(argv[s],"-x")==0) { bX=true; s++; }
+    else if (s<argc && strcmp(argv[s],"-q")==0) { bQ=true; s++; }
+    else if (s<argc && strstr(argv[s],"-t")==argv[s]) { threads=std::stoi(argv[s]+2); if (threads<1) usage(); s++; }
+    else if (argc!=s || (bX && bQ) || ((bX || bQ) && threads>0)) usage();
+    else break;
+  }
+  // process all input without DOC,DOCNO,DOCHDR tags
+  if (bX) {
+    int curr=0, size=1<<20; char* buff=(char*)malloc(size); // read all
+    for (;;) { if (curr==size) buff=(char*)realloc(buff,size*=2); int r=fread(buff+curr,1,size-curr,stdin); if (r<=0) break; curr+=r; }
+    process(ob,buff,curr); ob.put('\n'); ob.flush(stdout); // process
+    free(buff); buff=NULL;
+    return 0;
+  }
+  if (bQ) {
+    for (bool bfirst=true;;) { std::string line; getline(std::cin, line); if (!std::cin) break;
+      int tstart=line.rfind("Query topic=\"");
+      if (tstart>=0) { tstart+=13;
+        int tend=line.find("\"",tstart);
+        if (tend>=0) { if (bfirst) bfirst=false; else ob.put('\n'); ob.write(line.c_str()+tstart,tend-tstart); ob.put(';'); continue; }
+      }
+      process(ob,line.c_str(),line.length(),(tstart>=0?0:' '));
+    } ob.put('\n'); ob.flush(stdout);
+    return 0;
+  }
+  // data from stdin, batches of DOCs
+  runBatches(stdin,stdout,true,std::max(threads,1),"",processDocs);
   return 0;
 }
@@ -0,0 +1,197 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "porterstemmer.hpp"
+#include "mbatch.hpp"
+#include "mtokenizer.hpp"
+
+// == tokenize ======================================================
+// cut strings into tokens and do case-folding, stemming, expansion, etc.
+// used on the indexing side and the querying side (and they have to agree)
+
+
+inline char* tolower(/*modified*/char* s) { for (char* t=s;*t!='\0';t++) { *t=::tolower(*t); } return s; }
+
+static inline uint fnv1a(cchar* s, int sl) { uint h=2166136261u; for (int i=0;i<sl;i++) { h=(h^(byte)s[i])*16777619u; } return h; }
+
+// bounded direct-mapped cache (lowercase form -> stem) in front of a reentrant porter stemmer, word frequencies are Zipfian
+static std::atomic<uint64_t> stemhits(0), stemmisses(0); // totals from finished threads
+class StemCache { protected: static const int SIZE=1<<16, MAXL=24;
+  struct E { uint8_t kl, sl; char k[MAXL], s[MAXL]; }; E* e; PorterStemmer ps;
+public: uint64_t hits, misses;
+  StemCache() { e=(E*)calloc(SIZE,sizeof(E)); hits=misses=0; }
+  virtual ~StemCache() { stemhits+=hits; stemmisses+=misses; free(e); e=NULL; }
+  inline char* stem(/*modified*/char* s, int sl) {
+    if (sl>=MAXL) { misses++; int k=ps.stem(s,0,sl-1); s[k+1]='\0'; return s; } // too long to cache
+    E& x=e[fnv1a(s,sl)&(SIZE-1)];
+    if (x.kl==sl && memcmp(x.k,s,sl)==0) { hits++; memcpy(s,x.s,x.sl); s[x.sl]='\0'; return s; }
+    misses++; x.kl=sl; memcpy(x.k,s,sl);
+    int k=ps.stem(s,0,sl-1); s[k+1]='\0'; x.sl=k+1; memcpy(x.s,s,x.sl); return s;
+  }
+};
+static thread_local StemCache stemcache; // one per thread
+inline char* pstem(/*modified*/char* s, int sl) { return stemcache.stem(s,sl); } // porter stemmer
+inline void dumpStemCache() { uint64_t h=stemhits+stemcache.hits, t=h+stemmisses+stemcache.misses;
+  std::cerr<<"stem cache hits "<<h<<" of "<<t<<" ("<<(t>0?100.0*h/t:0.0)<<"%)"<<std::endl; }
+
+// compact open-addressing set of words (read-only after loading), words packed in one pool, no allocation on lookup
+class WordSet { protected: std::string pool; std::vector<uint> slots; uint n; // slot is pool offset+1, 0 empty
+  inline uint find(cchar* w, int wl) const { uint m=slots.size()-1;
+    for (uint i=fnv1a(w,wl)&m;;i=(i+1)&m) { uint o=slots[i]; if (o==0) return i; cchar* t=pool.c_str()+o-1; if (memcmp(t,w,wl)==0 && t[wl]=='\0') return i; } }
+public:
+  WordSet() : slots(16,0), n(0) { }
+  inline uint size() const { return n; }
+  inline bool contains(cchar* w, int wl) const { return slots[find(w,wl)]!=0; }
+  inline bool contains(cchar* w) const { return contains(w,strlen(w)); }
+  void insert(cchar* w, int wl) { if (contains(w,wl)) return;
+    if (2*(n+1)>slots.size()) { std::vector<uint> old(slots.size()*2,0); old.swap(slots); // grow, load <= 1/2
+      for (uint o : old) { if (o!=0) { cchar* t=pool.c_str()+o-1; slots[find(t,strlen(t))]=o; } } }
+    slots[find(w,wl)]=pool.size()+1; pool.append(w,wl); pool.push_back('\0'); n++; }
+  inline void insert(cchar* w) { insert(w,strlen(w)); }
+};
+
+inline void removein_dump(std::vector<cchar*>& v, const WordSet& words, /*out*/std::string& err) { err+="removing: ";
+  int drop=0; for (int i=0; i<v.size(); i++) { if (words.contains(v[i])) { err+=v[i]; err+=" "; drop++; } else v[i-drop]=v[i]; } v.resize(v.size()-drop); err+="\n";
+}
+
+inline void removenotin_dump(std::vector<cchar*>& v, const WordSet& words, /*out*/std::string& err) { err+="removing: ";
+  int drop=0; for (int i=0; i<v.size(); i++) { if (v[i][0]!='#' && !words.contains(v[i])) { err+=v[i]; err+=" "; drop++; } else v[i-drop]=v[i]; } v.resize(v.size()-drop); err+="\n";
+}
+
+static inline bool equals(cchar* s, size_t l, cchar* t) { size_t tl=strlen(t); return l==tl && memcmp(s,t,l)==0; }
+static inline bool startswith(cchar* s, size_t l, cchar* t) { size_t tl=strlen(t); return l>=tl && memcmp(s,t,tl)==0; }
+
+class MTokenize { public: bool bMath, bQuery, bStats; protected: bool bkeywords; WordSet keywords, stopwords; //bStats: stem cache hit rate on stderr
+  bool me[256], tk[256], tkmath[256]; inline void set(bool* t, int s, int e, bool v=true) { for (int i=s;i<=e;i++) t[i]=v; }
+  void setupArrays() { set(me,0,255,false); me[0]=me[' ']=me['\t']=me['\r']=me['\n']=me['#']=true;
+    set(tk,0,127,false); set(tk,128,255); set(tk,'a','z'); set(tk,'A','Z'); set(tk,'0','9');
+    for (int i=0;i<256;i++) tkmath[i]=tk[i]; tkmath['#']=true; } //tk['<']=true;
+
+public:
+  inline MTokenize() : bMath(false), bQuery(false), bStats(false), bkeywords(false) { setupArrays(); }
+  void setT(cchar* keywordsfile) { bkeywords=true; loadwords(keywordsfile, keywords, true); }
+  void setS(cchar* stopwordsfile, bool bstem) { loadwords(stopwordsfile, stopwords, bstem); }
+
+  inline void doProcess(char* data, int size, /*in/out*/ std::vector<cchar*>& v) {
+    byte* d=(byte*)data; byte* dend=d+size;
+    if (bMath) {
+      for(;d<dend;d++) {
+        if (tkmath[*d]) { byte* s=d++;
+          if (*s=='#') { // try to find math tuples
+            for (;;d++) {
+              if (d>=dend || me[*d]) {
+                if (d>s+3 && ((s[1]=='{' && d[-1]=='}') || (s[1]=='(' && d[-1]==')') || (s[1]=='!' && d[-1]=='!')) && d[0]=='#' && (d+1>=dend || d[1]==' ')) { d[1]=0; v.push_back((cchar*)s); break; }
+                else { d=s; break;}
+              }
+            }
+          } else { // non-math doesn't start with #
+            for(;;d++) { if (d>=dend || !tk[*d]) { *d=0; v.push_back(pstem(tolower((char*)s),d-s)); break; } }
+          }
+        }
+      }
+    } else { // runs of tk with fused case folding
+      forRuns<TkClass,true>(d,dend,tk,[&](byte* s, byte* d) { *d=0; v.push_back(pstem((char*)s,d-s)); });
+    }
+  }
+
+  inline void doProcessNoStem(char* data, int size, /*in/out*/ std::vector<cchar*>& v) {
+    byte* d=(byte*)data; byte* dend=d+size;
+    if (bMath) {
+      for(;d<dend;d++) {
+        if (tkmath[*d]) { byte* s=d++;
+          if (*s=='#') { // try to find math tuples
+            for (;;d++) {
+              if (d>=dend || me[*d]) {
+                if (d>s+3 && ((s[1]=='{' && d[-1]=='}') || (s[1]=='(' && d[-1]==')')) && d[0]=='#' && (d+1>=dend || d[1]==' ')) { d[1]=0; v.push_back((cchar*)s); break; }
+                else { d=s; break;}
+              }
+            }
+          } else { // non-math doesn't start with #
+            for(;;d++) { if (d>=dend || !tk[*d]) { *d=0; v.push_back(tolower((char*)s)); break; } }
+          }
+        }
+      }
+    } else { // runs of tk with fused case folding
+      forRuns<TkClass,true>(d,dend,tk,[&](byte* s, byte* d) { *d=0; v.push_back((cchar*)s); });
+    }
+  }
+
+  inline char* dup(std::string& t) { return (char*)memcpy(malloc(t.size()+1),t.c_str(),t.size()+1); }
+
+  inline void loadwords(std::string& line, /*in/out*/ WordSet& words, bool bstem) {
+    char* data=dup(line); // new owned array
+    std::vector<cchar*> v; if (bstem) doProcess(data,line.size(),v); else doProcessNoStem(data,line.size(),v);
+    for (int i=0;i<v.size();i++) { words.insert(v[i]); }
+    free(data); data=NULL; // cleanup
+  }
+
+  inline void loadwords(cchar* wordsfile, /*in/out*/ WordSet& words, bool bstem) {
+    std::ifstream in(wordsfile); if (!in) {std::cerr<<"ERROR: missing file "<<wordsfile<<std::endl;exit(-1);}
+    for (std::string line; getline(in,line) && in;) { loadwords(line,words,bstem); }
+    std::cerr<<"loaded "<<words.size()<<" words from "<<wordsfile<<std::endl;
+  }
+
+  // tokenize line [data,data+size) in place (data[size] is overwritten), v is reused scratch space
+  void process(char* data, size_t size, /*out*/OutBuf& out, std::string& err, std::vector<cchar*>& v) {
+    v.clear(); doProcess(data,size,v);
+    if (stopwords.size()>0) removein_dump(v,stopwords,err); // remove stopwords
+    if (bkeywords) removenotin_dump(v,keywords,err); // remove non-math token if not in keywords
+    for (int i=0;i<v.size();i++) { if (i>0) out.put(' '); out.write(v[i],strlen(v[i])); } out.put('\n');
+  }
+
+  // batch input is tokenized in place, lines are spans of b.in
+  #define FORLINES(b) LineReader in(b.in); cchar* line; size_t l; std::vector<cchar*> v; while (in.getline(line,l))
+
+  // query line (optional "name;" prefix kept), also used in-process by msearch
+  void processQuery(char* line, size_t l, /*out*/OutBuf& out, std::string& err, std::vector<cchar*>& v) {
+    char* s=(char*)memchr(line,';',l); char* t=(char*)memchr(line,' ',l);
+    if (s!=NULL && (t==NULL || s<t)) { out.write(line,s+1-line); out.put(' '); l-=s+1-line; line=s+1; }
+    process(line,l,out,err,v);
+  }
+
+  // batch of query lines
+  void processQueries(Batch& b) { FORLINES(b) { processQuery((char*)line,l,b.out,b.err,v); } }
+
+  // batch of lines without DOC tags
+  void processLines(Batch& b) { FORLINES(b) { process((char*)line,l,b.out,b.err,v); } }
+
+  // batch of whole DOCs (state machine restarts at each DOC)
+  void processDocs(Batch& b) { OutBuf& out=b.out; int docHDRLine=0;
+    FORLINES(b) {
+      if (docHDRLine>=0) { // header lines of a DOC, -1 once in body
+        if (docHDRLine==0) {
+          if (equals(line,l,"<DOC>") || startswith(line,l,"<DOCNO>")) { out.write(line,l); out.put('\n'); continue; }
+          else if (equals(line,l,"<DOCHDR>")) { docHDRLine++; out.write(line,l); out.put('\n'); continue; }
+          else docHDRLine=-1; // no DOCHDR, process this line
+        } else {
+          if (equals(line,l,"</DOCHDR>")) { docHDRLine=-1; out.write(line,l); out.put('\n'); }
+          else if (docHDRLine<2) { docHDRLine++; out.write(line,l); out.put('\n'); } // pass through non-processed lines, but only first of DocHDR
+          continue;
+        }
+      }
+      if (equals(line,l,"</DOC>")) { out.write(line,l); out.put('\n'); docHDRLine=0; }
+      else { process((char*)line,l,out,b.err,v); }
+    }
+  }
+  #undef FORLINES
+
+  int process(int threads) {
+    // first line decides the type of input
+    std::string first; for (int c;(c=getc(stdin))!=EOF;) { first+=(char)c; if (c=='\n') break; }
+    if (first.size()==0) return 0;
+    std::string line=first.substr(0,first.size()-(first[first.size()-1]=='\n'?1:0));
+    if (bQuery) runBatches(stdin,stdout,false,threads,first,[this](Batch& b){ processQueries(b); });
+    else if (line.compare("<DOC>")!=0) runBatches(stdin,stdout,false,threads,first,[this](Batch& b){ processLines(b); }); // process all
+    else runBatches(stdin,stdout,true,threads,first,[this](Batch& b){ processDocs(b); });
+    if (bStats) dumpStemCache();
+    return 0;
+  }
+};
@@ -6,12 +6,54 @@
 #include <cstring> //for Windows
 #include <vector>
 #include <algorithm>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+typedef uint8_t byte; typedef const byte cbyte; typedef const char cchar;
+
+// == character class runs ======================================================
+// 64-byte class bitmasks (4x SSE2) give all token boundaries of a block, optionally fused with ASCII case folding;
+// table is the scalar fallback (and tail), table[c] true for bytes inside tokens
+
+#ifdef __SSE2__
+struct NonWsClass { // not ' ' '\t' '\r' '\n'
+  static inline uint mask16(__m128i x) { return ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x,_mm_set1_epi8(' ')),_mm_cmpeq_epi8(x,_mm_set1_epi8('\t'))),
+    _mm_or_si128(_mm_cmpeq_epi8(x,_mm_set1_epi8('\r')),_mm_cmpeq_epi8(x,_mm_set1_epi8('\n')))))&0xFFFF; }
+};
+struct TkClass { // >=128, a-z, A-Z, 0-9 (unsigned range checks via min)
+  static inline uint mask16(__m128i x) { __m128i a=_mm_sub_epi8(_mm_or_si128(x,_mm_set1_epi8(0x20)),_mm_set1_epi8('a')), n=_mm_sub_epi8(x,_mm_set1_epi8('0'));
+    return _mm_movemask_epi8(_mm_or_si128(x,_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(a,_mm_set1_epi8(25)),a),_mm_cmpeq_epi8(_mm_min_epu8(n,_mm_set1_epi8(9)),n)))); }
+};
+static inline __m128i foldASCII(__m128i x) { __m128i u=_mm_sub_epi8(x,_mm_set1_epi8('A'));
+  return _mm_add_epi8(x,_mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(u,_mm_set1_epi8(25)),u),_mm_set1_epi8(0x20))); }
+#else
+struct NonWsClass {}; struct TkClass {};
+#endif
+
+// calls f(s,e) for each maximal run [s,e) of token bytes in [d,dend), bFold lowercases A-Z in place first
+template <class C, bool bFold, class F> inline void forRuns(byte* d, byte* dend, const bool* table, F f) {
+  byte* s=NULL; //open run
+#ifdef __SSE2__
+  for (;d+64<=dend;d+=64) { uint64_t m=0;
+    for (int i=0;i<4;i++) { __m128i x=_mm_loadu_si128((const __m128i*)(d+16*i));
+      if (bFold) { x=foldASCII(x); _mm_storeu_si128((__m128i*)(d+16*i),x); }
+      m|=(uint64_t)C::mask16(x)<<(16*i); }
+    uint64_t p=(m<<1)|(s!=NULL?1:0), starts=m&~p, ends=~m&p;
+    for (;;) {
+      if (s==NULL) { if (starts==0) break; s=d+__builtin_ctzll(starts); starts&=starts-1; }
+      else { if (ends==0) break; f(s,d+__builtin_ctzll(ends)); s=NULL; ends&=ends-1; }
+    }
+  }
+#endif
+  for (;d<dend;d++) { if (bFold && *d>='A' && *d<='Z') *d+='a'-'A';
+    if (table[*d]) { if (s==NULL) s=d; } else if (s!=NULL) { f(s,d); s=NULL; } }
+  if (s!=NULL) f(s,dend);
+}
 
 // == tokenizer ======================================================
 // cut strings into tokens delimited by whitespace (no processing)
 
-typedef uint8_t byte; typedef const byte cbyte; typedef const char cchar;
-
 static int toweight(cchar* s, uint sl) { return std::stoi(std::string(s,sl)); }
 
 // copy strings into internal storage
@@ -26,8 +68,8 @@ class StringList { protected: char* d; int dsize; int dused; public:
 };
 
 class MTokenizer { protected:
-  bool ws[256]; inline void set(bool* t, int s, int e, bool v=true) { for (int i=s;i<=e;i++) t[i]=v; }
-  void setupArrays() { set(ws,0,255,false); ws[' ']=ws['\t']=ws['\r']=ws['\n']=true; }
+  bool ws[256], nonws[256]; inline void set(bool* t, int s, int e, bool v=true) { for (int i=s;i<=e;i++) t[i]=v; }
+  void setupArrays() { set(ws,0,255,false); ws[' ']=ws['\t']=ws['\r']=ws['\n']=true; for (int i=0;i<256;i++) nonws[i]=!ws[i]; }
 
 public:
   class TokenList : protected StringList { protected:
@@ -47,12 +89,9 @@ public:
   inline MTokenizer() { setupArrays(); }
   // used by minvert and msearch
   inline void process(cchar* data, int size,/*out*/TokenList& tokens) {
-    cbyte* d=(cbyte*)data; cbyte* dend=d+size; int weight=1;
-    for(;d<dend;d++) {
-      if (!ws[*d]) { cbyte* s=d++;
-        for(;;d++) { if (d>=dend || ws[*d]) { if (d-s>4&&s[0]=='#'&&s[1]=='!'&&d[-2]=='!'&&d[-1]=='#') weight=toweight((cchar*)s+2,d-(s+4)); else tokens.push_back(s,d-s,weight); break; } }
-      }
-    }
+    byte* d=(byte*)data; int weight=1; // not modified (no folding)
+    forRuns<NonWsClass,false>(d,d+size,nonws,[&](byte* s, byte* d) {
+      if (d-s>4&&s[0]=='#'&&s[1]=='!'&&d[-2]=='!'&&d[-1]=='#') weight=toweight((cchar*)s+2,d-(s+4)); else tokens.push_back(s,d-s,weight); });
     //for (int i=0;i<tokens.size();i++) { cout<<tokens.at(i)<<" "; } cout<<endl;
   }
 };
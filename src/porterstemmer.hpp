@@ -53,12 +53,18 @@
    should be done before stem(...) is called.
 */
 
-static char * b;       /* buffer for word to be stemmed */
-static int k,k0,j;     /* j is a general offset into the string */
+/* Adapted for mtextsearch: the statics b, k, k0, j are members of a
+   PorterStemmer context object so that several threads can stem at once,
+   each using its own PorterStemmer. */
+
+class PorterStemmer {
+
+char * b;       /* buffer for word to be stemmed */
+int k,k0,j;     /* j is a general offset into the string */
 
 /* cons(i) is TRUE <=> b[i] is a consonant. */
 
-static int cons(int i)
+int cons(int i)
 {  switch (b[i])
    {  case 'a': case 'e': case 'i': case 'o': case 'u': return FALSE;
       case 'y': return (i==k0) ? TRUE : !cons(i-1);
@@ -77,7 +83,7 @@ static int cons(int i)
       ....
 */
 
-static int m()
+int m()
 {  int n = 0;
    int i = k0;
    while(TRUE)
@@ -104,14 +110,14 @@ static int m()
 
 /* vowelinstem() is TRUE <=> k0,...j contains a vowel */
 
-static int vowelinstem()
+int vowelinstem()
 {  int i; for (i = k0; i <= j; i++) if (! cons(i)) return TRUE;
    return FALSE;
 }
 
 /* doublec(j) is TRUE <=> j,(j-1) contain a double consonant. */
 
-static int doublec(int j)
+int doublec(int j)
 {  if (j < k0+1) return FALSE;
    if (b[j] != b[j-1]) return FALSE;
    return cons(j);
@@ -126,7 +132,7 @@ static int doublec(int j)
 
 */
 
-static int cvc(int i)
+int cvc(int i)
 {  if (i < k0+2 || !cons(i) || cons(i-1) || !cons(i-2)) return FALSE;
    {  int ch = b[i];
       if (ch == 'w' || ch == 'x' || ch == 'y') return FALSE;
@@ -136,7 +142,7 @@ static int cvc(int i)
 
 /* ends(s) is TRUE <=> k0,...k ends with the string s. */
 
-static int ends(const char * s)
+int ends(const char * s)
 {  int length = s[0];
    if (s[length] != b[k]) return FALSE; /* tiny speed-up */
    if (length > k-k0+1) return FALSE;
@@ -148,7 +154,7 @@ static int ends(const char * s)
 /* setto(s) sets (j+1),...k to the characters in the string s, readjusting
    k. */
 
-static void setto(const char * s)
+void setto(const char * s)
 {  int length = s[0];
    memmove(b+j+1,s+1,length);
    k = j+length;
@@ -156,7 +162,7 @@ static void setto(const char * s)
 
 /* r(s) is used further down. */
 
-static void r(const char * s) { if (m() > 0) setto(s); }
+void r(const char * s) { if (m() > 0) setto(s); }
 
 /* step1ab() gets rid of plurals and -ed or -ing. e.g.
 
@@ -180,7 +186,7 @@ static void r(const char * s) { if (m() > 0) setto(s); }
 
 */
 
-static void step1ab()
+void step1ab()
 {  if (b[k] == 's')
    {  if (ends("\04" "sses")) k -= 2; else
       if (ends("\03" "ies")) setto("\01" "i"); else
@@ -204,14 +210,14 @@ static void step1ab()
 
 /* step1c() turns terminal y to i when there is another vowel in the stem. */
 
-static void step1c() { if (ends("\01" "y") && vowelinstem()) b[k] = 'i'; }
+void step1c() { if (ends("\01" "y") && vowelinstem()) b[k] = 'i'; }
 
 
 /* step2() maps double suffices to single ones. so -ization ( = -ize plus
    -ation) maps to -ize etc. note that the string before the suffix must give
    m() > 0. */
 
-static void step2() { switch (b[k-1])
+void step2() { switch (b[k-1])
 {
     case 'a': if (ends("\07" "ational")) { r("\03" "ate"); break; }
               if (ends("\06" "tional")) { r("\04" "tion"); break; }
@@ -252,7 +258,7 @@ static void step2() { switch (b[k-1])
 
 /* step3() deals with -ic-, -full, -ness etc. similar strategy to step2. */
 
-static void step3() { switch (b[k])
+void step3() { switch (b[k])
 {
     case 'e': if (ends("\05" "icate")) { r("\02" "ic"); break; }
               if (ends("\05" "ative")) { r("\00" ""); break; }
@@ -269,7 +275,7 @@ static void step3() { switch (b[k])
 
 /* step4() takes off -ant, -ence etc., in context <c>vcvc<v>. */
 
-static void step4()
+void step4()
 {  switch (b[k-1])
     {  case 'a': if (ends("\02" "al")) break; return;
        case 'c': if (ends("\04" "ance")) break;
@@ -299,7 +305,7 @@ static void step4()
 /* step5() removes a final -e if m() > 1, and changes -ll to -l if
    m() > 1. */
 
-static void step5()
+void step5()
 {  j = k;
    if (b[k] == 'e')
    {  int a = m();
@@ -317,6 +323,8 @@ static void step5()
    file.
 */
 
+public:
+
 int stem(char * p, int i, int j)
 {  b = p; k = j; k0 = i; /* copy the parameters into statics */
    if (k <= k0+1) return k; /*-DEPARTURE-*/
@@ -333,6 +341,8 @@ int stem(char * p, int i, int j)
    return k;
 }
 
+};
+
 /*--------------------stemmer definition ends here------------------------*/
 
 #if FALSE
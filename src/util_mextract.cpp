@@ -7,20 +7,25 @@
 #include <fstream>
 #include <string>
 #include <set>
+#include <vector>
 #include <stdio.h>
 
-/* read in TREC files, output only specified DOCs */
+#include "mdictionary.hpp"
+#include "mdocstore.hpp"
 
-enum ProcessMode {accum,drop,output};
+/* read in TREC files, output only specified DOCs (streaming, or random access via a document index) */
 
-static inline std::string mathDOCNO(bool bMath, std::string s) { if (bMath) { int c=s.find_last_of('_'); if (c>=0) s=s.substr(c+1); } return s; }
+enum ProcessMode {accum,drop,output};
 
-static void process(char* fn, bool bMath) {
-  // get docs to extract
-  std::set<std::string> extract;
+static void loadDOCNOs(char* fn, bool bMath, /*out*/std::set<std::string>& extract) {
   std::ifstream in(fn); if (!in) {std::cerr<<"ERROR: invalid "<<fn<<std::endl; exit(-1);}
   for (;;) { std::string line; getline(in, line); if (!in) break; extract.insert(mathDOCNO(bMath, line)); }
   std::cerr<<"Loaded "<<extract.size()<<" DOCNOs for extraction"<<std::endl;
+}
+
+static void process(char* fn, bool bMath) {
+  // get docs to extract
+  std::set<std::string> extract; loadDOCNOs(fn,bMath,extract);
   // process with tags from stdin
   int curr=0, size=1<<20; char* buff=(char*)malloc(size); ProcessMode m; int extracted=0, processed=0;
   NEXTDOC:
@@ -45,10 +50,27 @@ static void process(char* fn, bool bMath) {
   std::cerr<<"Extracted "<<extracted<<" of "<<processed<<" documents"<<std::endl;
 }
 
+// pread only the requested DOCs, output in collection order (same as streaming)
+static void extract(char* indexfn, char* fn, int threads) {
+  DocStore store; store.load(indexfn);
+  std::set<std::string> docnos; loadDOCNOs(fn,false,docnos); // store maps math DOCNOs
+  std::vector<DocLoc> v; for (const std::string& d : docnos) { store.find(d,v); }
+  std::sort(v.begin(),v.end()); v.erase(std::unique(v.begin(),v.end()),v.end());
+  store.output(v,stdout,threads);
+  std::cerr<<"Extracted "<<v.size()<<" of "<<store.size()<<" documents"<<std::endl;
+}
+
+static void usage() {std::cerr<<"Usage: ./mextract.exe [-M] docno_values.txt < input > output"<<std::endl
+  <<"       ./mextract.exe [-M] -i out.docidx input.trec ...      (index DOCNO locations)"<<std::endl
+  <<"       ./mextract.exe [-t#] -x in.docidx docno_values.txt > output   (random access extraction)"<<std::endl; exit(-1);}
+
 int main(int argc, char *argv[]) {
-  int s=1; bool bMath=false;
+  int s=1, threads=1; bool bMath=false;
   if (s<argc && strstr(argv[s],"-M")==argv[s] && *(argv[s]+2)==0) { bMath=true; s++; }
-  if (argc-s!=1) { std::cerr<<"Usage: ./mextract.exe [-M] docno_values.txt < input > output"<<std::endl; return -1; }
+  if (s<argc && strstr(argv[s],"-t")==argv[s]) { threads=std::stoi(argv[s]+2); if (threads<1) usage(); s++; }
+  if (s<argc && strcmp(argv[s],"-i")==0) { if (argc-s<3) usage(); DocStore::build(argv[s+1],std::vector<std::string>(argv+s+2,argv+argc),bMath); return 0; }
+  if (s<argc && strcmp(argv[s],"-x")==0) { if (argc-s!=3) usage(); extract(argv[s+1],argv[s+2],threads); return 0; }
+  if (argc-s!=1) usage();
   process(argv[s], bMath);
   return 0;
 }
@@ -0,0 +1,32 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <iostream>
+#include <string>
+#include <stdio.h> // for rename
+#include "mmeta.hpp"
+#include "msegment.hpp"
+
+// == MSegments::tryLoad testing ======================================================
+// a manifest passes valid(), then its segment (or the segment meta) disappears before loading:
+// tryLoad returns NULL without exit, and loads again once the files are back
+
+static void gone(cchar* fn, cchar* f) { std::string g=(std::string)f+".gone";
+  if (!MSegments::valid(fn)) {std::cerr<<"ERROR: not valid before removing "<<f<<std::endl; exit(-1);}
+  if (rename(f,g.c_str())!=0) {std::cerr<<"ERROR: Could not rename "<<f<<std::endl; exit(-1);}
+  MSegments* x=MSegments::tryLoad(fn,false); if (x!=NULL) {std::cerr<<"ERROR: loaded with "<<f<<" removed"<<std::endl; exit(-1);}
+  if (rename(g.c_str(),f)!=0) {std::cerr<<"ERROR: Could not rename "<<g<<std::endl; exit(-1);}
+}
+
+int main(int argc, char *argv[]) {
+  if (argc!=2) {std::cerr<<"Usage: ./test_msegments.exe index.mseg"<<std::endl; exit(-1);}
+  cchar* fn=argv[1]; std::vector<std::string> fns=MSegments::files(fn);
+  MSegments* x=MSegments::tryLoad(fn,false); if (x==NULL) {std::cerr<<"ERROR: could not load "<<fn<<std::endl; exit(-1);}
+  int doccount=x->doccount; delete x;
+  for (int i=0;i<fns.size();i++) { gone(fn,fns[i].c_str()); gone(fn,(fns[i]+".meta").c_str()); }
+  x=MSegments::tryLoad(fn,false); if (x==NULL || x->doccount!=doccount) {std::cerr<<"ERROR: could not load "<<fn<<" again"<<std::endl; exit(-1);}
+  delete x;
+  std::cout<<"tryLoad ok "<<fns.size()<<" segments"<<std::endl;
+}
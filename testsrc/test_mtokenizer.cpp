@@ -0,0 +1,157 @@
+// (C) Copyright 2019 Andrew R. J. Kane <arkane (at) uwaterloo.ca>, All Rights Reserved.
+//     Released for academic purposes only, All Other Rights Reserved.
+//     This software is provided "as is" with no warranties, and the authors are not liable for any damages from its use.
+// project: https://github.com/andrewrkane/mtextsearch
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include "mtokenize.hpp" // includes mtokenizer.hpp
+
+// == reference tokenizers ======================================================
+// the original scalar byte loops of MTokenize (serial, one std::string per line, unmodified stemmer) and MTokenizer
+
+class RefTokenize { public: bool bMath, bQuery; protected: PorterStemmer ps;
+  bool me[256], tk[256], tkmath[256]; inline void set(bool* t, int s, int e, bool v=true) { for (int i=s;i<=e;i++) t[i]=v; }
+  void setupArrays() { set(me,0,255,false); me[0]=me[' ']=me['\t']=me['\r']=me['\n']=me['#']=true;
+    set(tk,0,127,false); set(tk,128,255); set(tk,'a','z'); set(tk,'A','Z'); set(tk,'0','9');
+    for (int i=0;i<256;i++) tkmath[i]=tk[i]; tkmath['#']=true; }
+  inline char* lower(/*modified*/char* s) { for (char* t=s;*t!='\0';t++) { *t=::tolower(*t); } return s; }
+  inline char* stem(/*modified*/char* s, int sl) { int k=ps.stem(s,0,sl-1); s[k+1]='\0'; return s; }
+
+public:
+  RefTokenize() : bMath(false), bQuery(false) { setupArrays(); }
+
+  void doProcess(char* data, int size, /*in/out*/ std::vector<cchar*>& v) {
+    byte* d=(byte*)data; byte* dend=d+size;
+    if (bMath) {
+      for(;d<dend;d++) {
+        if (tkmath[*d]) { byte* s=d++;
+          if (*s=='#') { // try to find math tuples
+            for (;;d++) {
+              if (d>=dend || me[*d]) {
+                if (d>s+3 && ((s[1]=='{' && d[-1]=='}') || (s[1]=='(' && d[-1]==')') || (s[1]=='!' && d[-1]=='!')) && d[0]=='#' && (d+1>=dend || d[1]==' ')) { d[1]=0; v.push_back((cchar*)s); break; }
+                else { d=s; break;}
+              }
+            }
+          } else { // non-math doesn't start with #
+            for(;;d++) { if (d>=dend || !tk[*d]) { *d=0; v.push_back(stem(lower((char*)s),d-s)); break; } }
+          }
+        }
+      }
+    } else {
+      for(;d<dend;d++) {
+        if (tk[*d]) { cbyte* s=d++;
+          for(;;d++) { if (d>=dend || !tk[*d]) { *d=0; v.push_back(stem(lower((char*)s),d-s)); break; } }
+        }
+      }
+    }
+  }
+
+  void process(const std::string& line, std::ostream& out) {
+    std::vector<char> data(line.begin(),line.end()); data.push_back('\0');
+    std::vector<cchar*> v; doProcess(&data[0],line.size(),v);
+    for (int i=0;i<v.size();i++) { out<<(i==0?"":" ")<<v[i]; } out<<std::endl;
+  }
+
+  void process(std::istream& in, std::ostream& out) {
+    std::string line; getline(in,line); if (!in) return;
+    if (bQuery) {
+      for (;;getline(in,line)) { if (!in) return;
+        int s=line.find(';'), t=line.find(' '); if (s>=0 && (t<0 || s<t)) { out<<line.substr(0,s+1)<<" "; line=line.substr(s+1); }
+        process(line,out); }
+    } else if (line.compare("<DOC>")!=0) {
+      for (;;getline(in,line)) { if (!in) return; process(line,out); } // process all
+    } else {
+      out<<line<<std::endl;
+      NEXTDOC:
+      int docHDRLine=0;
+      for (;;) { getline(in,line); if (!in) return;
+        if (docHDRLine<=0) {
+          if (line.compare("<DOC>")==0 || line.find("<DOCNO>")==0) { out<<line<<std::endl; }
+          else if (line.compare("<DOCHDR>")==0 || docHDRLine>0) { docHDRLine++; out<<line<<std::endl; }
+          else { goto PROCESSLINE; } // no DOCHDR
+        } else {
+          if (line.compare("</DOCHDR>")==0) { out<<line<<std::endl; break; }
+          else if (docHDRLine<2) { docHDRLine++; out<<line<<std::endl; } // pass through non-processed lines, but only first of DocHDR
+        }
+      }
+      for (;;) { getline(in,line); if (!in) return;
+        PROCESSLINE:
+        if (line.compare("</DOC>")==0) { out<<line<<std::endl; goto NEXTDOC; }
+        else { process(line,out); }
+      }
+    }
+  }
+};
+
+// whitespace separated tokens with #!weight!# markers, as "token/weight "
+static std::string refTokenizer(const std::string& in) { std::string r; cbyte* d=(cbyte*)in.c_str(); cbyte* dend=d+in.size(); int weight=1;
+  for(;d<dend;d++) {
+    if (!(*d==' '||*d=='\t'||*d=='\r'||*d=='\n')) { cbyte* s=d++;
+      for(;;d++) { if (d>=dend || *d==' '||*d=='\t'||*d=='\r'||*d=='\n') { if (d-s>4&&s[0]=='#'&&s[1]=='!'&&d[-2]=='!'&&d[-1]=='#') weight=toweight((cchar*)s+2,d-(s+4)); else r+=std::string((cchar*)s,d-s)+"/"+std::to_string(weight)+" "; break; } }
+    }
+  }
+  return r;
+}
+
+// == MTokenize and MTokenizer testing ======================================================
+// token streams of the batch tokenizers (vectorized runs, fused folding, stem cache) == reference,
+// in text, math and query modes on random documents and on the documents from stdin
+
+static std::string tokenize(const std::string& in, bool bMath, bool bQuery) {
+  MTokenize t; t.bMath=bMath; t.bQuery=bQuery; Batch b; b.in=in;
+  if (bQuery) t.processQueries(b); else if (in.compare(0,6,"<DOC>\n")!=0) t.processLines(b); else t.processDocs(b);
+  return std::string(b.out.data(),b.out.length());
+}
+
+static std::string reference(const std::string& in, bool bMath, bool bQuery) {
+  RefTokenize t; t.bMath=bMath; t.bQuery=bQuery; std::istringstream is(in); std::ostringstream os; t.process(is,os); return os.str();
+}
+
+static std::string tokenizer(const std::string& in) { MTokenizer t; MTokenizer::TokenList tokens; std::string r;
+  t.process(in.c_str(),in.size(),tokens);
+  for (int i=0;i<tokens.size();i++) { r+=std::string(tokens[i])+"/"+std::to_string(tokens.weight(i))+" "; }
+  return r;
+}
+
+static void check(const std::string& in) {
+  for (int m=0;m<3;m++) { bool bMath=(m==1), bQuery=(m==2);
+    std::string a=reference(in,bMath,bQuery), b=tokenize(in,bMath,bQuery);
+    if (a!=b) { int i=0; for (;i<a.size() && i<b.size() && a[i]==b[i];i++) {}
+      std::cerr<<"ERROR: tokens differ (math="<<bMath<<",query="<<bQuery<<") at "<<i<<": "<<a.substr(i,40)<<" | "<<b.substr(i,40)<<std::endl; exit(-1); } }
+  if (refTokenizer(in)!=tokenizer(in)) {std::cerr<<"ERROR: MTokenizer tokens differ for "<<in<<std::endl; exit(-1);}
+}
+
+// random words, math tuples, weights, long runs across 64-byte blocks, UTF-8 and all other bytes
+static std::string randomLine(std::mt19937& r) { static cchar* parts[]={ "#(a,b,n)#", "#{x,y}#", "#!2!#", "#(bad", "#()#", "#!#", "a#(b)#", "α", "é", "ABC", "Running", "caresses", "ponies", "<center>", "@[`{/:", "0123456789", "q1;" };
+  std::string s; int n=r()%40, mode=r()%4;
+  for (int i=0;i<n;i++) { int k=r()%10;
+    if (mode==0) { s+=(char)(1+r()%255); if (s.back()=='\n') s.back()=' '; continue; } // any byte but newline
+    if (k<4) s+=parts[r()%(sizeof(parts)/sizeof(parts[0]))];
+    else if (k<8) { int l=(k==7?60+r()%140:1+r()%12); for (int j=0;j<l;j++) s+=(char)(r()%3==0?'A'+r()%26:'a'+r()%26); }
+    else s+=(char)(128+r()%128);
+    s+=" \t\r  "[r()%5]; }
+  return s;
+}
+
+static std::string randomDoc(std::mt19937& r, int id) { std::string d="<DOC>\n<DOCNO>d"+std::to_string(id)+"</DOCNO>\n";
+  if (r()%3==0) d+="<DOCHDR>\nhttp://x.org/A"+std::to_string(id)+"\nHeader Line\n</DOCHDR>\n";
+  for (int i=r()%6;i>0;i--) { d+=randomLine(r)+"\n"; }
+  return d+"</DOC>\n";
+}
+
+int main(int argc, char *argv[]) {
+  if (argc>1 && strcmp(argv[1],"-r")==0) { // reference output of stdin ([-M] [-q] as mtokenize)
+    RefTokenize t; for (int s=2;s<argc;s++) { if (strcmp(argv[s],"-M")==0) t.bMath=true; else if (strcmp(argv[s],"-q")==0) t.bQuery=true; else {std::cerr<<"Usage: ./test_mtokenizer.exe [-r [-M] [-q]] < in"<<std::endl; exit(-1);} }
+    t.process(std::cin,std::cout); return 0; }
+  std::mt19937 r(1); int n=0;
+  for (int i=0;i<2000;i++,n++) { std::string s;
+    if (i%2==0) { for (int j=r()%8;j>=0;j--) s+=randomDoc(r,j); } else { for (int j=r()%8;j>=0;j--) s+=randomLine(r)+"\n"; }
+    check(s); }
+  std::string in, line; for (;std::getline(std::cin,line);) { in+=line+"\n"; }
+  if (in.size()>0) { check(in); n++; }
+  std::cout<<"tokenize ok "<<n<<" inputs"<<std::endl;
+}